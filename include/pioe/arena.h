@@ -0,0 +1,93 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Bump-pointer arena for short-lived allocations
+ *
+ * An arena hands out memory by advancing a pointer in its current block
+ * and releases everything at once in pe_arena_reset(). Each engine owns
+ * one arena which is reset after every frame; it is reachable from
+ * pe_frame_t and, on the engine's worker thread, from pe_arena_current(),
+ * so engines and plugins can allocate per-frame temporaries without
+ * malloc, locks or fragmentation.
+ *
+ * When a block runs full another one is chained. The next reset merges
+ * them into one block large enough for the whole frame, so a steady
+ * workload settles on a single block.
+ *
+ * An arena is not thread-safe.
+ *
+ * @date	10/17/2026
+ * @file	arena.h
+ */
+
+#ifndef PIOENGINE_ARENA_H
+#define PIOENGINE_ARENA_H
+
+#include <stddef.h>
+
+#include "pioe/export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PE_ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct pe_arena_block pe_arena_block_t;
+
+typedef struct pe_arena {
+	pe_arena_block_t *blocks;	/* current block first */
+	size_t block_size;
+	size_t used;		/* bytes handed out since the last reset */
+	size_t high;		/* most bytes used between two resets */
+} pe_arena_t;
+
+/* block_size 0 means PE_ARENA_BLOCK_SIZE, -1 if out of memory */
+PE_EXPORT int pe_arena_init(pe_arena_t * a, size_t block_size);
+PE_EXPORT void pe_arena_free(pe_arena_t * a);
+
+/**
+ * @brief Allocate size bytes, aligned for any type
+ *
+ * The memory stays valid until the next pe_arena_reset().
+ *
+ * @return NULL if out of memory
+ */
+PE_EXPORT void *pe_arena_alloc(pe_arena_t * a, size_t size);
+PE_EXPORT char *pe_arena_strdup(pe_arena_t * a, const char *s);
+
+/* release all allocations at once */
+PE_EXPORT void pe_arena_reset(pe_arena_t * a);
+
+/*
+ * arena of the frame running on this thread, NULL outside of frames. The
+ * engine workers set it for engine_frame() and the timers before it.
+ */
+PE_EXPORT pe_arena_t *pe_arena_current();
+PE_EXPORT void pe_arena_set_current(pe_arena_t * a);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
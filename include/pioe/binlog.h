@@ -0,0 +1,132 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Binary logs with deferred formatting
+ *
+ * While a binary log is open, LOG_* calls do not format anything. Each
+ * call site (see pe_log_site_t) is described once in the file, and every
+ * call only appends the site id, logger name id, timestamp, frame id and
+ * the raw arguments to a buffer of the calling thread. Strings are
+ * copied, everything else is stored as the value. Full buffers are
+ * appended to the file; pe_logger_flush() writes all of them.
+ *
+ * pioe-logdump renders such a file as text with any log format.
+ *
+ * The file starts with PE_BINLOG_MAGIC and the version, followed by
+ * records that start with a pe_binlog_record_t byte. All numbers are in
+ * host byte order, strings are a uint16_t length and the bytes.
+ *
+ * - BINLOG_NAME: uint32 symbol id, string
+ * - BINLOG_SITE: uint32 id, uint8 level, uint32 line, uint8 nargs,
+ *   nargs pe_log_arg_t bytes, string format, string file, string func
+ * - BINLOG_ENTRY: uint32 site, uint32 name, uint64 usec, uint64 frame,
+ *   uint32 thread, the arguments (int 4 bytes, string as above, all others 8 bytes)
+ * - BINLOG_TEXT: uint8 level, uint32 name, uint64 usec, uint64 frame,
+ *   uint32 thread, uint32 line, string file, string func, string message. Written for
+ *   pe_logger() and sites with arguments that cannot be stored.
+ *
+ * @date	10/17/2026
+ * @file	binlog.h
+ */
+
+#ifndef PIOENGINE_BINLOG_H
+#define PIOENGINE_BINLOG_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pioe/export.h"
+#include "pioe/logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PE_BINLOG_MAGIC "PIOEBLOG"
+#define PE_BINLOG_MAGIC_LEN 8
+#define PE_BINLOG_VERSION 2
+
+typedef enum {
+	BINLOG_NAME = 1,
+	BINLOG_SITE,
+	BINLOG_ENTRY,
+	BINLOG_TEXT,
+} pe_binlog_record_t;
+
+/* how a printf argument is passed and stored */
+typedef enum {
+	LOG_ARG_INT = 1,	/* also char and short */
+	LOG_ARG_LONG,
+	LOG_ARG_LLONG,
+	LOG_ARG_INTMAX,
+	LOG_ARG_SIZE,
+	LOG_ARG_PTRDIFF,
+	LOG_ARG_DOUBLE,
+	LOG_ARG_POINTER,
+	LOG_ARG_STRING,
+} pe_log_arg_t;
+
+/**
+ * @brief Find the next conversion in a printf format
+ *
+ * "%%" is skipped. types receives the arguments the conversion takes:
+ * '*' widths and precisions first, then the value.
+ *
+ * @param len the length of the conversion
+ * @param ntypes number of types, -1 if an argument cannot be stored
+ * @return the '%' of the conversion or NULL if there is none
+ */
+PE_EXPORT const char *pe_binlog_spec(const char *format, size_t *len,
+				     pe_log_arg_t types[3], int *ntypes);
+
+/**
+ * @brief Log to a binary file instead of formatting lines
+ *
+ * Flushed at exit, but only pe_logger_binary_close() closes it.
+ *
+ * @return 0 on success, -1 on error or if a binary log is already open
+ */
+PE_EXPORT int pe_logger_binary_open(const char *path);
+
+/* write all buffers and close the binary log. Nothing may log meanwhile. */
+PE_EXPORT void pe_logger_binary_close();
+
+/* append the buffers of all threads to the binary log, if any */
+PE_EXPORT void pe_binlog_flush();
+
+/* called by the logger, return -1 if no binary log is open */
+PE_EXPORT int pe_binlog_entry(pe_log_site_t *site, const pe_logger_t *logger,
+			      pe_loglevel_t level, const char *file,
+			      const char *func, unsigned int line,
+			      const char *format, va_list *args);
+PE_EXPORT int pe_binlog_text(const pe_logger_t *logger, pe_loglevel_t level,
+			     const char *file, const char *func,
+			     unsigned int line, const char *format,
+			     va_list *args);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
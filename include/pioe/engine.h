@@ -41,6 +41,12 @@
 #include "pioe/export.h"
 #include "pioe/thread.h"
 #include "pioe/plugin.h"
+#include "pioe/event.h"
+#include "pioe/queue.h"
+#include "pioe/timer.h"
+#include "pioe/arena.h"
+#include "pioe/pool.h"
+#include "pioe/manifest.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -54,11 +60,64 @@ typedef enum {
 	STATE_STOP,
 } pe_engine_state_t;
 
+/* what the frame clock does when frames run late */
+typedef enum {
+	OVERRUN_CATCHUP,	/* run the missed frames back to back */
+	OVERRUN_DROP,		/* skip missed frames, realign to the next tick */
+} pe_overrun_policy_t;
+
+/* what to do with events for an engine whose queue is full */
+typedef enum {
+	QUEUE_DROP_NEWEST,	/* drop the pushed event */
+	QUEUE_DROP_OLDEST,	/* drop the oldest queued event to make room */
+	QUEUE_COALESCE,		/* merge axis events into an overflow table */
+	QUEUE_BLOCK,		/* make the producer wait for room */
+} pe_queue_policy_t;
+
+typedef enum {
+	REPLAY_RECORDED,	/* replay frames at the recorded frame rate */
+	REPLAY_FAST,		/* replay frames back to back on a virtual clock */
+} pe_replay_speed_t;
+
+typedef enum {
+	TIMER_FRAMES,		/* count frames of the engine's frame clock */
+	TIMER_MS,		/* count milliseconds of the monotonic clock */
+} pe_timer_unit_t;
+
+typedef enum {
+	RUN_FIXED,		/* run frames at a fixed rate */
+	RUN_EVENT,		/* run a frame when an event source fires */
+} pe_run_mode_t;
+
 typedef struct pe_frame pe_frame_t;
 typedef struct pe_engine pe_engine_t;
+typedef struct pe_engine_stats pe_engine_stats_t;
+
+/* log-linear histogram: 4 buckets per power of two, up to ~16 seconds */
+#define PE_STATS_BUCKETS 96
+
+struct pe_engine_stats {
+	uint64_t frames;	/* frames run */
+	uint64_t skipped;	/* frames skipped because the engine was busy */
+	uint64_t overruns;	/* frames that took longer than their period */
+	uint64_t total;		/* usec spent in engine_frame */
+	uint64_t max;		/* longest frame in usec */
+	uint64_t events;	/* events delivered to engine_frame */
+	uint64_t coalesced;	/* raw events merged by coalescing */
+	uint64_t dropped;	/* events dropped because the queue was full */
+	uint64_t queue_high;	/* most events queued between two frames */
+	uint64_t histogram[PE_STATS_BUCKETS];	/* frame durations */
+};
 
 struct pe_frame {
 	uint64_t id;
+	uint64_t scheduled;	/* deadline of this frame, pe_tstamp_mono_usec() */
+	uint64_t started;	/* time the frame actually started */
+	uint64_t period;	/* usec between two frames of this engine */
+	const pe_event_t *events;	/* events since the engine's last frame */
+	size_t events_len;
+	size_t events_coalesced;	/* raw events merged into events */
+	pe_arena_t *arena;	/* reset after the frame */
 	pe_mutex_t mutex;
 };
 struct pe_engine {
@@ -67,12 +126,26 @@ struct pe_engine {
 	char *version;
 	char *script_language;
 	char *script_suffix;
+	unsigned int frame_rate;	/* preferred rate in hz, 0 for every frame */
 	pe_mutex_t *mutex;
 };
 
+/*
+ * What an engine library returns from its engine_meta(). It is read
+ * without calling engine_load(), so listing engines does not start them.
+ * pe_engine_load() copies it into pe_engine_t before engine_load().
+ */
+typedef struct pe_engine_meta {
+	const char *name;
+	const char *version;
+	const char *script_language;
+	const char *script_suffix;
+} pe_engine_meta_t;
+
 typedef struct pe_engine_handle {
         void *handle;
         pe_engine_state_t state;
+        const pe_engine_meta_t *(*meta) ();
         int (*load) (pe_engine_t *);
         int (*unload) ();
         int (*init) ();
@@ -82,7 +155,33 @@ typedef struct pe_engine_handle {
         int (*load_script) (const char *);
         int (*execute_code) (const char *);
         pe_engine_t *engine;
-	pe_thread_t thread;
+	pe_thread_t thread;		/* long-lived frame worker */
+	pe_cond_t frame_ready;		/* signaled when _frame or job is pending */
+	bool frame_pending;
+	/* engine call to run on the worker, see engine_call() in engine.c */
+	int (*job) (struct pe_engine_handle *, const void *);
+	const void *job_arg;
+	int job_result;
+	pe_cond_t job_done;
+	pe_cond_t frame_done;		/* signaled when a frame has finished */
+	bool in_frame;			/* worker is running a frame */
+	bool redispatch;		/* event mode skipped it, see engine.c */
+	pe_engine_stats_t stats;
+	pe_queue_t *events;		/* filled by pe_engine_push_event() */
+	pe_queue_policy_t queue_policy;
+	/* QUEUE_COALESCE: events that did not fit into the queue */
+	pe_mutex_t overflow_mutex;
+	bool overflowing;		/* new events go to overflow */
+	pe_event_t *overflow;
+	size_t overflow_len;
+	pe_event_coalescer_t overflow_index;
+	pe_event_t *batch;		/* events of the current frame */
+	pe_event_coalescer_t coalescer;
+	pe_timer_wheel_t frame_timers;	/* ticks are frame ids */
+	pe_timer_wheel_t ms_timers;	/* ticks are monotonic milliseconds */
+	pe_arena_t arena;		/* per-frame allocations */
+	uint64_t divisor;		/* run on every divisor-th frame */
+	uint64_t next_tick;		/* frame id of the next dispatch */
 	pe_frame_t _frame;
 } pe_engine_handle_t;
 
@@ -101,9 +200,103 @@ PE_EXPORT int pe_engine_run();
 PE_EXPORT int pe_engine_stop();
 PE_EXPORT int pe_engine_load_script(const char *file);
 PE_EXPORT size_t pe_engine_find_engines(char **result);
+
+/**
+ * @brief Engines in the search directories
+ *
+ * Read from the engine manifest cache if it is still valid, otherwise
+ * the directories are scanned and the cache is rebuilt. Engines seen for
+ * the first time are opened for their engine_meta(), but not loaded.
+ *
+ * @param engines set to the engines, valid until pe_engine_rescan()
+ * @return number of engines
+ */
+PE_EXPORT size_t pe_engine_list(const pe_engine_info_t **engines);
+
+/* ignore the engine manifest cache and scan again on the next lookup */
+PE_EXPORT void pe_engine_rescan();
 PE_EXPORT int pe_engine_init();
 PE_EXPORT int pe_engine_quit();
 PE_EXPORT uint64_t pe_engine_frame_id();
+PE_EXPORT void pe_engine_set_overrun_policy(pe_overrun_policy_t policy);
+/* queue an event for all engines, safe to call from any thread. Returns -1
+ * if an engine's queue was full and an event had to be dropped for it. */
+PE_EXPORT int pe_engine_push_event(pe_event_t *ev);
+/**
+ * @brief Fire timer after n frames or milliseconds
+ *
+ * Due timers fire on the engine's worker right before its engine_frame,
+ * so millisecond timers have the resolution of the engine's frame rate.
+ * In event mode the loop wakes up for the next millisecond timer.
+ *
+ * Timers of an engine may only be scheduled and cancelled (see
+ * pe_timer_cancel()) from that engine's callbacks.
+ */
+PE_EXPORT int pe_engine_timer_add(pe_engine_t *e, pe_timer_t *timer,
+				  pe_timer_unit_t unit, uint64_t n);
+
+/**
+ * @brief Record every delivered event to the file at path
+ *
+ * Events are recorded as the engine running most often received them.
+ * See pioe/record.h. The recording is closed by pe_engine_quit().
+ */
+PE_EXPORT int pe_engine_record(const char *path);
+
+/**
+ * @brief Feed the events of the recording at path instead of live input
+ *
+ * pe_engine_run() then pushes every recorded event for the frame it was
+ * recorded for, ignores pe_engine_push_event() and stops at the end of
+ * the recording. Like pe_engine_simulate(), frames run in lockstep, so no
+ * frame is skipped. The frame rate is taken from the recording.
+ */
+PE_EXPORT int pe_engine_replay(const char *path, pe_replay_speed_t speed);
+
+/**
+ * @brief Run the given number of frames as fast as possible, then stop
+ *
+ * Enables the virtual clock (see pe_clock_set_virtual()), which moves by
+ * one frame period per frame, so frame timestamps and timers behave as
+ * in a real run. A frame starts once all engines finished the previous
+ * one. The frames per second reached are logged at the end.
+ */
+PE_EXPORT int pe_engine_simulate(uint64_t frames);
+
+/**
+ * @brief Set capacity and overflow policy of an engine's event queue
+ *
+ * With name NULL, the settings apply to all loaded engines and are the
+ * default for engines loaded later. Not possible while running.
+ *
+ * With QUEUE_COALESCE, events that do not fit into the queue are merged
+ * per device and code into an overflow table of the same capacity and
+ * delivered after the queued events. Key events are dropped once the
+ * table is full as well. QUEUE_BLOCK must not be used by producers that
+ * run on an engine worker. Replays never block and drop instead.
+ */
+PE_EXPORT int pe_engine_set_queue(const char *name, size_t capacity,
+				  pe_queue_policy_t policy);
+
+/* merge axis events per frame, on by default. See pioe/event.h */
+PE_EXPORT void pe_engine_set_coalesce(bool enable);
+PE_EXPORT int pe_engine_set_run_mode(pe_run_mode_t mode);
+/* RUN_EVENT: wake the frame loop up, safe to call from any thread */
+PE_EXPORT int pe_engine_wakeup();
+/* RUN_EVENT: run a frame once pe_tstamp_mono_usec() reaches deadline */
+PE_EXPORT int pe_engine_wakeup_at(uint64_t deadline);
+/* RUN_EVENT: run a frame whenever fd becomes readable (edge triggered) */
+PE_EXPORT int pe_engine_watch_fd(int fd);
+PE_EXPORT int pe_engine_set_frame_rate(unsigned int hz);
+PE_EXPORT unsigned int pe_engine_frame_rate();
+PE_EXPORT int pe_engine_set_engine_rate(const char *name, unsigned int hz);
+
+/* copy the frame statistics of engine e into out */
+PE_EXPORT int pe_engine_stats(pe_engine_t *e, pe_engine_stats_t *out);
+/* estimate the p-th percentile (0.0 - 1.0) of the frame duration in usec */
+PE_EXPORT uint64_t pe_engine_stats_percentile(const pe_engine_stats_t *s, double p);
+/* log the statistics of all engines */
+PE_EXPORT void pe_engine_stats_dump();
 
 PE_EXPORT pe_class_t *pe_engine_define_class(pe_plugin_t *p, const char *name, pe_class_t *parent);
 PE_EXPORT pe_method_t *pe_engine_define_class_method(pe_class_t *c, int (*method)(pe_param_t*), size_t num_params, ...);
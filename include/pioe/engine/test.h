@@ -0,0 +1,66 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Engine without a script language, for the tests
+ *
+ * It records the events handed to its frames, so ptest can check what
+ * the queue policies let through.
+ *
+ * @date	10/17/2026
+ * @file	test.h
+ */
+
+#ifndef PIOENGINE_ENGINE_TEST_H
+#define PIOENGINE_ENGINE_TEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pioe/export.h"
+#include "pioe/engine.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* events recorded over all frames, the rest is ignored */
+#define PE_TESTENGINE_EVENTS 64
+
+/* the engine loaded from this library, NULL before engine_load() */
+PE_EXPORT pe_engine_t *pe_testengine();
+
+/* events of all frames so far, in order */
+PE_EXPORT size_t pe_testengine_events(const pe_event_t **events);
+
+/* make every frame take at least ms milliseconds, on the virtual clock
+ * the frame moves the clock instead of sleeping */
+PE_EXPORT void pe_testengine_set_delay(int ms);
+
+/* frames run so far */
+PE_EXPORT uint64_t pe_testengine_frames();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Input events passed from plugins to the engines
+ *
+ * Plugins hand events to pe_engine_push_event(). Every engine gets its own
+ * copy in its event queue, and receives all events that arrived since its
+ * last frame as one array in pe_frame_t.
+ *
+ * Before the array is handed to the engine, axis events are coalesced per
+ * (device, type, code): EVENT_ABS keeps the last value, EVENT_REL sums up
+ * the deltas. EVENT_KEY events are never merged.
+ *
+ * @date	10/17/2026
+ * @file	event.h
+ */
+
+#ifndef PIOENGINE_EVENT_H
+#define PIOENGINE_EVENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "pioe/export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum {
+	EVENT_KEY,		/* keys and buttons, value is 1 (down) or 0 (up) */
+	EVENT_ABS,		/* absolute axis, value is the position */
+	EVENT_REL,		/* relative axis or motion, value is the delta */
+} pe_event_type_t;
+
+typedef struct pe_event {
+	uint32_t device;	/* plugin defined device id */
+	uint16_t type;		/* pe_event_type_t */
+	uint16_t code;		/* plugin defined key/axis code */
+	int32_t value;
+	uint64_t time;		/* pe_tstamp_mono_usec() of the event */
+} pe_event_t;
+
+typedef struct pe_event_slot {
+	uint32_t gen;
+	uint32_t index;
+} pe_event_slot_t;
+
+/* index of the axis events seen in the current batch */
+typedef struct pe_event_coalescer {
+	pe_event_slot_t *slots;
+	size_t mask;
+	uint32_t gen;		/* slots of older generations are free */
+} pe_event_coalescer_t;
+
+/**
+ * @brief Prepare a coalescer for batches of up to capacity events
+ */
+PE_EXPORT int pe_event_coalescer_init(pe_event_coalescer_t *c, size_t capacity);
+PE_EXPORT void pe_event_coalescer_free(pe_event_coalescer_t *c);
+
+/**
+ * @brief Start a new batch, forgetting all events seen so far
+ */
+PE_EXPORT void pe_event_coalescer_reset(pe_event_coalescer_t *c);
+
+/**
+ * @brief Merge ev into the batch events or append it
+ *
+ * @param len number of events in the batch, incremented on append
+ * @param max room of the batch
+ * @return 1 if ev was merged, 0 if it was appended, -1 if the batch is
+ * full and ev could not be merged
+ */
+PE_EXPORT int pe_event_coalesce_one(pe_event_coalescer_t *c,
+				    pe_event_t *events, size_t *len,
+				    size_t max, const pe_event_t *ev);
+
+/**
+ * @brief Merge axis events of the batch in place
+ *
+ * A merged event stays at the position of its first occurrence and gets
+ * the time of the latest one. Other events keep their order.
+ *
+ * @param events the batch, at most the capacity given to init
+ * @param len number of events in the batch
+ * @param collapsed incremented by the number of events merged away
+ * @return the new number of events
+ */
+PE_EXPORT size_t pe_event_coalesce(pe_event_coalescer_t *c, pe_event_t *events,
+				   size_t len, uint64_t *collapsed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -33,8 +33,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "pioe/export.h"
+#include "pioe/symbol.h"
 #include "config.h"
 
 #ifdef __cplusplus
@@ -51,10 +53,20 @@ typedef enum {
 	LALL = 64
 } pe_loglevel_t;
 
+/* what an asynchronous logger does with a line while its queue is full */
+typedef enum {
+	LOG_OVERFLOW_BLOCK,	/* wait for the writer thread */
+	LOG_OVERFLOW_DROP,	/* drop the line and count it */
+} pe_log_overflow_t;
+
+
+/* a log format compiled by pe_logger_set_format() */
+typedef struct pe_log_format pe_log_format_t;
 
 typedef struct logger {
-	char *name;
+	pe_symbol_t name;
 	char *format;
+	const pe_log_format_t *program;
 	char *format_date;
 	char *format_time;
 
@@ -76,6 +88,37 @@ typedef struct logger {
 
 #define LOGGER_MAX_LEN 1024
 
+/* arguments of a log call site that binary logs can store */
+#define PE_LOG_SITE_ARGS 16
+
+/**
+ * One LOG_* call in the source, registered when it first logs to a
+ * binary log (see binlog.h). Until then all zero.
+ */
+typedef struct pe_log_site {
+	uint32_t id;
+	bool dynamic;		/* arguments are not supported, log as text */
+	uint8_t nargs;
+	uint8_t types[PE_LOG_SITE_ARGS];	/* pe_log_arg_t */
+	uint16_t precision;	/* bit i: types[i] is the .* of a string */
+	size_t max_size;	/* of an entry in the binary log */
+} pe_log_site_t;
+
+/* everything a log line is rendered from, see pe_logger_render() */
+typedef struct pe_log_line {
+	pe_loglevel_t level;
+	const char *name;
+	const char *file;
+	const char *func;
+	unsigned int line;
+	uint64_t usec;
+	uint64_t frame;
+	unsigned int thread;	/* pe_thread_id() */
+	const char *message;	/* used if format is NULL */
+	const char *format;
+	va_list *args;
+} pe_log_line_t;
+
 #if !defined(MACRO_LOGGER)
 #define MACRO_LOGGER *pe_logger_core()
 #endif
@@ -84,11 +127,15 @@ typedef struct logger {
 #define __FILENAME__ __FILE__
 #endif
 
-#define LOGGER(LEVEL, ...) pe_logger(MACRO_LOGGER, LEVEL, \
-				     __FILENAME__, \
-				     __func__, \
-				     __LINE__, \
-				     __VA_ARGS__)
+/* a static site per call lets binary logs refer to the format by id */
+#define LOGGER(LEVEL, ...) do { \
+	static pe_log_site_t _pe_log_site; \
+	pe_logger_site(&_pe_log_site, MACRO_LOGGER, LEVEL, \
+		       __FILENAME__, \
+		       __func__, \
+		       __LINE__, \
+		       __VA_ARGS__); \
+} while (0)
 
 #define LOG_INFO(...)       LOGGER(LINFO, __VA_ARGS__)
 #define LOG_WARN(...)       LOGGER(LWARNING, __VA_ARGS__)
@@ -101,7 +148,23 @@ PE_EXPORT void
 pe_logger(pe_logger_t logger, pe_loglevel_t level, const char *filepath, const char *func,
 	  unsigned int line, char *fmt, ...);
 
+/* pe_logger() for a LOG_* call site, see LOGGER() */
+PE_EXPORT void
+pe_logger_site(pe_log_site_t *site, pe_logger_t logger, pe_loglevel_t level,
+	       const char *filepath, const char *func, unsigned int line,
+	       char *fmt, ...);
+
+/**
+ * @brief Render a line with the format of logger
+ *
+ * @return the length of the line in buf, at most size - 1
+ */
+PE_EXPORT size_t pe_logger_render(const pe_logger_t *logger,
+				  const pe_log_line_t *line, char *buf,
+				  size_t size);
+
 PE_EXPORT void pe_logger_set_level(pe_loglevel_t level);
+/* @return 0 on success, -1 if format has an unknown variable */
 PE_EXPORT int pe_logger_set_format(char *format);
 PE_EXPORT int pe_logger_set_format_date(char *format);
 PE_EXPORT int pe_logger_set_format_time(char *format);
@@ -109,6 +172,43 @@ PE_EXPORT int pe_logger_new(pe_logger_t *logger, const char *name);
 PE_EXPORT int pe_logger_init(FILE * out, FILE * err);
 PE_EXPORT pe_logger_t *pe_logger_core();
 
+/**
+ * @brief Hand formatted lines to a background writer thread
+ *
+ * Afterwards pe_logger() only formats the line and copies it into a
+ * queue of capacity lines, the writer thread writes and flushes them in
+ * batches. At exit the queue is drained, but the writer keeps running,
+ * since other threads may still be logging.
+ *
+ * @return 0 on success, -1 if already started or on error
+ */
+PE_EXPORT int pe_logger_async_start(size_t capacity,
+				    pe_log_overflow_t overflow);
+
+/* flush, stop the writer thread and write synchronously again */
+PE_EXPORT void pe_logger_async_stop();
+
+/*
+ * wait until every line logged so far has been written and flushed.
+ * Lines staged by other threads are not included.
+ */
+PE_EXPORT void pe_logger_flush();
+
+/**
+ * @brief Stage the lines of the calling thread in a buffer of its own
+ *
+ * Staged lines are written as one block by pe_logger_thread_flush(),
+ * when the buffer is full, and right away for errors. Engine threads
+ * stage their lines and flush them after each frame. Disabling flushes.
+ *
+ * @return 0 on success, -1 if out of memory
+ */
+PE_EXPORT int pe_logger_thread_buffered(bool enable);
+PE_EXPORT void pe_logger_thread_flush();
+
+/* lines dropped by LOG_OVERFLOW_DROP so far */
+PE_EXPORT uint64_t pe_logger_dropped();
+
 #ifdef __cplusplus
 }
 #endif
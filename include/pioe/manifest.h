@@ -0,0 +1,133 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Cache of discovered engine libraries
+ *
+ * Finding engines means scanning the search directories for library
+ * names. Name, version and script suffix of an engine are only read when
+ * they are asked for, see pe_manifest_probe(). The manifest stores the
+ * result in a file, together with the modification times of the scanned
+ * directories and of every engine found. On the next start a stat() of
+ * each of them tells whether the manifest is still valid, so neither
+ * the directories are read nor any library is loaded.
+ *
+ * Adding or removing a file changes the mtime of its directory and
+ * replacing a library changes its own mtime or size, both invalidate the
+ * manifest. The mtime of the current directory is not checked, files
+ * change there all the time; changing into another directory still
+ * invalidates the manifest, since relative search paths then resolve to
+ * other directories.
+ *
+ * @date	10/17/2026
+ * @file	manifest.h
+ */
+
+#ifndef PIOENGINE_MANIFEST_H
+#define PIOENGINE_MANIFEST_H
+
+#include <stdint.h>
+
+#include "pioe/export.h"
+#include "pioe/util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct pe_engine_info {
+	char *key;		/* name for pe_engine_load_by_name() */
+	char *path;		/* absolute path of the library */
+	char *name;		/* NULL until probed */
+	char *version;
+	char *suffix;		/* script suffix */
+	int64_t mtime;
+	int64_t size;
+} pe_engine_info_t;
+
+typedef struct pe_manifest_dir {
+	char *path;		/* absolute */
+	int64_t mtime;
+} pe_manifest_dir_t;
+
+PE_VEC_DECLARE(pe_engine_info_vec, pe_engine_info_t, 4)
+PE_VEC_DECLARE(pe_manifest_dir_vec, pe_manifest_dir_t, 8)
+
+typedef struct pe_manifest {
+	pe_engine_info_vec_t engines;	/* in search order */
+	pe_manifest_dir_vec_t dirs;
+} pe_manifest_t;
+
+/**
+ * @brief Read the manifest in file and check that it is still valid
+ *
+ * @param dirs search directories, relative ones resolve against the
+ *	       current directory, directories that don't exist are ignored
+ * @return 0 if m holds a valid manifest, -1 if it is missing or stale
+ */
+PE_EXPORT int pe_manifest_load(pe_manifest_t * m, const char *file,
+			       const char *dirs[], size_t ndirs);
+
+/**
+ * @brief Build a manifest by scanning dirs for engine libraries
+ *
+ * Files named prefix + key + suffix become engines with that key, none of
+ * them is loaded. When several directories have an engine with the same
+ * key, the first wins.
+ *
+ * @return 0 on success, -1 on error
+ */
+PE_EXPORT int pe_manifest_scan(pe_manifest_t * m, const char *dirs[],
+			       size_t ndirs, const char *prefix,
+			       const char *suffix);
+
+/**
+ * @brief Read name, version and suffix of the engines not probed yet
+ *
+ * Each library is opened for its engine_meta() and closed again, its
+ * engine_load() is not called. Engines that can't be opened are left
+ * out.
+ *
+ * @return number of engines probed or left out, 0 if m did not change
+ */
+PE_EXPORT int pe_manifest_probe(pe_manifest_t * m);
+
+/* write m to file, creating missing parent directories */
+PE_EXPORT int pe_manifest_save(const pe_manifest_t * m, const char *file);
+
+/* NULL if no engine has that key */
+PE_EXPORT const pe_engine_info_t *pe_manifest_find(pe_manifest_t * m,
+						   const char *key);
+
+PE_EXPORT void pe_manifest_free(pe_manifest_t * m);
+
+/*
+ * $XDG_CACHE_HOME/pioe/engines.cache or ~/.cache/pioe/engines.cache,
+ * NULL if neither variable is set. The string is static.
+ */
+PE_EXPORT const char *pe_manifest_default_file();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
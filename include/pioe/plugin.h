@@ -44,6 +44,7 @@
 #include "pioe/logger.h"
 #include "pioe/export.h"
 #include "pioe/util.h"
+#include "pioe/symbol.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -96,26 +97,28 @@ typedef struct pe_class pe_class_t;
 typedef struct pe_method pe_method_t;
 
 struct pe_plugin {
-	char *name;
+	pe_symbol_t name;
 	char *version;
-	pe_class_t *classes;
-	size_t classes_i;
+	pe_map_t classes;	/* by name */
 };
 
 typedef struct pe_instance {
 
 } pe_instance_t;
 
+PE_VEC_DECLARE(pe_method_vec, pe_method_t *, 4)
+PE_VEC_DECLARE(pe_instance_vec, pe_instance_t *, 4)
+
 struct pe_class {
-	char *name;
+	pe_symbol_t name;
 	pe_class_t *parent;
-	pe_list_t *instance_methods;
-	pe_list_t *class_methods;
-	pe_list_t *instances;
+	pe_method_vec_t instance_methods;
+	pe_method_vec_t class_methods;
+	pe_instance_vec_t instances;
 };
 
 struct pe_method {
-	char *name;
+	pe_symbol_t name;
 	pe_param_t params;
 	int (*method)(pe_parameter_t*);
 };
@@ -131,6 +134,40 @@ struct pe_method {
  */
 PE_EXPORT pe_plugin_t *pe_plugin_register(char *name, char *version);
 
+/**
+ * @brief Look up a registered plugin
+ *
+ * @param name name of the plugin
+ * @return pe_plugin_t returns NULL if no such plugin is registered
+ */
+PE_EXPORT pe_plugin_t *pe_plugin_find(const char *name);
+
+/**
+ * @brief Look up a class defined by a plugin
+ *
+ * @param p pe_plugin_t the class was defined for
+ * @param name name of the class
+ * @return pe_class_t returns NULL if p has no such class
+ */
+PE_EXPORT pe_class_t *pe_plugin_class(pe_plugin_t *p, const char *name);
+
+/**
+ * @brief Get a parameter block for a method call
+ *
+ * Parameter blocks come from a pool, so building one per call neither
+ * mallocs nor locks. size is set to 0, nothing else is cleared.
+ *
+ * @return struct parameters returns NULL if out of memory
+ */
+PE_EXPORT struct parameters *pe_plugin_params_new();
+
+/**
+ * @brief Give a parameter block back to the pool
+ *
+ * @param p block from pe_plugin_params_new(), may be NULL
+ */
+PE_EXPORT void pe_plugin_params_release(pe_param_t *p);
+
 /**
  * @brief Read a parameter
  *
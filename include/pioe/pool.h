@@ -0,0 +1,89 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Fixed-size object pools with per-thread caches
+ *
+ * A pool hands out objects of one size. Free objects are kept in a list
+ * per thread; a thread only touches the shared list of the pool to move
+ * PE_POOL_BATCH objects at once when its own list runs empty or grows
+ * too long, and the pool only calls malloc to add PE_POOL_CHUNK objects
+ * when the shared list is empty, too. Allocating and releasing are O(1)
+ * and normally neither lock nor allocate.
+ *
+ * Objects may be released on another thread than they were allocated
+ * on. Objects cached by a thread that exits are not reused. Every pool
+ * records how many objects were in use at most, see pe_pool_stats_dump().
+ *
+ * @date	10/17/2026
+ * @file	pool.h
+ */
+
+#ifndef PIOENGINE_POOL_H
+#define PIOENGINE_POOL_H
+
+#include <stddef.h>
+
+#include "pioe/export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PE_POOL_MAX 32		/* pools with thread caches at once */
+#define PE_POOL_BATCH 32	/* objects moved between thread and pool */
+#define PE_POOL_CHUNK 256	/* objects allocated at once */
+
+typedef struct pe_pool {
+	const char *name;
+	size_t size;		/* object size */
+	int slot;		/* thread cache slot, -1 until first use */
+	unsigned int gen;	/* generation of slot */
+	char lock;		/* pe_spinlock_t */
+	void *free;		/* shared free list */
+	void *chunks;
+	size_t capacity;	/* objects allocated */
+	size_t in_use;
+	size_t high;		/* most objects in use at once */
+} pe_pool_t;
+
+/* static initializer, the pool registers itself on first use */
+#define PE_POOL_INIT(name, size) \
+	{ name, size, -1, 0, 0, NULL, NULL, 0, 0, 0 }
+
+PE_EXPORT void pe_pool_init(pe_pool_t * p, const char *name, size_t size);
+
+/* frees all objects, none of them may be in use anymore */
+PE_EXPORT void pe_pool_destroy(pe_pool_t * p);
+
+/* NULL if out of memory */
+PE_EXPORT void *pe_pool_alloc(pe_pool_t * p);
+PE_EXPORT void pe_pool_release(pe_pool_t * p, void *obj);
+
+/* log size and high-water mark of every pool */
+PE_EXPORT void pe_pool_stats_dump();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -25,21 +25,124 @@
  
 
 
+/**
+ * @brief	Bounded queues to pass fixed size elements between threads
+ *
+ * A pe_queue_t is a ring buffer of capacity (rounded up to a power of two)
+ * slots of elem_size bytes each. Elements are copied in and out, so the
+ * queue never allocates after pe_queue_new().
+ *
+ * The variant is chosen with the flags passed to pe_queue_new():
+ *
+ * - PE_QUEUE_SPSC: lock-free, exactly one thread may push and exactly one
+ *   (other) thread may pop.
+ * - PE_QUEUE_MPMC: lock-free for any number of producers and consumers.
+ *   Every slot carries a sequence number (Dmitry Vyukov's bounded MPMC
+ *   queue), so producers and consumers only contend on the head/tail
+ *   counter of their own side.
+ * - PE_QUEUE_BLOCKING: may be or'ed to either of the above. Push waits
+ *   while the queue is full and pop waits while it is empty. Waiting
+ *   threads spin briefly and then sleep on a condition variable of the
+ *   queue; the fast path stays lock-free.
+ *
+ * @date	10/17/2026
+ * @file	queue.h
+ */
+
 #ifndef PIOENGINE_QUEUE_H
 #define PIOENGINE_QUEUE_H
 
+#include <stddef.h>
+
+#include "pioe/export.h"
 #include "pioe/util.h"
+#include "pioe/thread.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#define PE_CACHELINE 64
+#define PE_CACHE_ALIGNED __attribute__((aligned(PE_CACHELINE)))
+
+typedef enum {
+	PE_QUEUE_SPSC = 0,
+	PE_QUEUE_MPMC = 1,
+	PE_QUEUE_BLOCKING = 2,
+} pe_queue_flags_t;
+
 typedef struct _pe_queue {
-	pe_llist_t *llist;
+	/* consumer side */
+	size_t head PE_CACHE_ALIGNED;
+	size_t tail_cache;	/* last tail seen by the consumer */
+
+	/* producer side */
+	size_t tail PE_CACHE_ALIGNED;
+	size_t head_cache;	/* last head seen by the producer */
+
+	/* read only after pe_queue_new() */
+	size_t mask PE_CACHE_ALIGNED;
+	size_t elem_size;
+	size_t slot_size;
+	int flags;
+	unsigned char *buf;
+
+	/* PE_QUEUE_BLOCKING only */
+	int push_waiters PE_CACHE_ALIGNED;
+	int pop_waiters;
+	pe_mutex_t wait_mutex;
+	pe_cond_t not_full;
+	pe_cond_t not_empty;
 } pe_queue_t;
 
+/**
+ * @brief Create a new queue
+ *
+ * @param capacity number of elements, rounded up to a power of two
+ * @param elem_size size of one element in bytes
+ * @param flags see pe_queue_flags_t
+ * @return the queue or NULL on error
+ */
+PE_EXPORT pe_queue_t *pe_queue_new(size_t capacity, size_t elem_size,
+				   int flags);
+PE_EXPORT void pe_queue_free(pe_queue_t *q);
+
+/**
+ * @brief Copy elem into the queue
+ *
+ * @return 0 on success, -1 if the queue is full (never if blocking)
+ */
+PE_EXPORT int pe_queue_push(pe_queue_t *q, const void *elem);
+
+/* like pe_queue_push(), but never waits, not even on a blocking queue */
+PE_EXPORT int pe_queue_try_push(pe_queue_t *q, const void *elem);
+
+/**
+ * @brief Copy the oldest element into elem and remove it from the queue
+ *
+ * @return 0 on success, -1 if the queue is empty (never if blocking)
+ */
+PE_EXPORT int pe_queue_pop(pe_queue_t *q, void *elem);
+
+/**
+ * @brief Copy up to max of the oldest elements into the array elems
+ *
+ * A blocking queue waits for at least one element.
+ *
+ * @return the number of elements copied
+ */
+PE_EXPORT size_t pe_queue_pop_batch(pe_queue_t *q, void *elems, size_t max);
+
+/* like pe_queue_pop_batch(), but never waits, not even on a blocking queue */
+PE_EXPORT size_t pe_queue_try_pop_batch(pe_queue_t *q, void *elems,
+					size_t max);
+
+/* number of queued elements. Only a snapshot if other threads are active. */
+PE_EXPORT size_t pe_queue_count(pe_queue_t *q);
+PE_EXPORT size_t pe_queue_capacity(pe_queue_t *q);
+
 #ifdef __cplusplus
 }
 #endif
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,113 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Append-only event recordings
+ *
+ * A recording is a binary file made of a pe_record_header_t followed by
+ * pe_record_entry_t records in the order the events were delivered.
+ * Entries carry the id of the frame the event was delivered in, so a
+ * replay can hand the engines the same batches again.
+ *
+ * The file is memory-mapped: appending an event is a copy into the
+ * mapping, the file is grown in large steps and the header always holds
+ * the number of complete entries, so a crash loses no more than what the
+ * kernel has not written back yet.
+ *
+ * All integers are stored in host byte order.
+ *
+ * @date	10/17/2026
+ * @file	record.h
+ */
+
+#ifndef PIOENGINE_RECORD_H
+#define PIOENGINE_RECORD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "pioe/export.h"
+#include "pioe/event.h"
+#include "pioe/thread.h"
+
+#define PE_RECORD_MAGIC "PIOEREC"
+#define PE_RECORD_VERSION 1
+
+typedef struct pe_record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t frame_rate;	/* frame rate of the recording run */
+	uint64_t count;		/* number of entries */
+} pe_record_header_t;
+
+typedef struct pe_record_entry {
+	uint64_t frame;		/* frame the event was delivered in */
+	pe_event_t event;
+} pe_record_entry_t;
+
+typedef struct pe_record {
+	int fd;
+	pe_record_header_t *header;	/* start of the mapping */
+	pe_record_entry_t *entries;
+	size_t size;		/* mapped bytes */
+	uint64_t pos;		/* next entry to replay */
+	bool writable;
+	pe_mutex_t mutex;	/* serializes appends */
+} pe_record_t;
+
+/**
+ * @brief Create (or truncate) path and open it for recording
+ */
+PE_EXPORT int pe_record_create(pe_record_t * r, const char *path,
+			       unsigned int frame_rate);
+
+/**
+ * @brief Open the recording at path for replay
+ */
+PE_EXPORT int pe_record_open(pe_record_t * r, const char *path);
+
+/**
+ * @brief Append an event delivered in frame, may be called from any thread
+ */
+PE_EXPORT int pe_record_append(pe_record_t * r, uint64_t frame,
+			       const pe_event_t * ev);
+
+/**
+ * @brief Next replayed entry delivered in a frame up to frame
+ *
+ * @return the entry or NULL if the next entry belongs to a later frame
+ */
+PE_EXPORT const pe_record_entry_t *pe_record_next(pe_record_t * r,
+						  uint64_t frame);
+
+/**
+ * @brief true if all entries have been replayed
+ */
+PE_EXPORT bool pe_record_eof(const pe_record_t * r);
+
+/**
+ * @brief Trim a recording to its entries and unmap it
+ */
+PE_EXPORT int pe_record_close(pe_record_t * r);
+
+#endif
@@ -0,0 +1,70 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Interned names
+ *
+ * pe_symbol() maps a name to a pe_symbol_t that is the same pointer for
+ * every call with an equal name, so names can be compared with == and
+ * all users of a name share one copy of it. Every symbol also has a
+ * small id, stable for the lifetime of the process, which script
+ * bindings can use to index their own per-name caches.
+ *
+ * Symbols are never freed. The table is thread-safe.
+ *
+ * @date	10/17/2026
+ * @file	symbol.h
+ */
+
+#ifndef PIOENGINE_SYMBOL_H
+#define PIOENGINE_SYMBOL_H
+
+#include <stdint.h>
+
+#include "pioe/export.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a NUL terminated name, equal names are equal pointers */
+typedef const char *pe_symbol_t;
+
+/* intern name, NULL if out of memory */
+PE_EXPORT pe_symbol_t pe_symbol(const char *name);
+
+/* NULL if name was never interned */
+PE_EXPORT pe_symbol_t pe_symbol_find(const char *name);
+
+/* ids start at 1 and count up in order of interning */
+PE_EXPORT uint32_t pe_symbol_id(pe_symbol_t s);
+
+/* NULL if there is no symbol with that id */
+PE_EXPORT pe_symbol_t pe_symbol_by_id(uint32_t id);
+
+PE_EXPORT uint32_t pe_symbol_count();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,9 +45,17 @@ extern "C" {
 #ifdef _WIN32
 typedef HANDLE pe_mutex_t;
 typedef HANDLE pe_thread_t;
+typedef HANDLE pe_cond_t;
 #else
 typedef pthread_mutex_t pe_mutex_t;
 typedef pthread_t pe_thread_t;
+typedef pthread_cond_t pe_cond_t;
+#endif
+
+#if defined(_MSC_VER)
+#define PE_THREAD_LOCAL __declspec(thread)
+#else
+#define PE_THREAD_LOCAL __thread
 #endif
 
 PE_EXPORT int pe_mutex_lock(pe_mutex_t * m);
@@ -55,9 +63,37 @@ PE_EXPORT int pe_mutex_unlock(pe_mutex_t * m);
 PE_EXPORT int pe_mutex_trylock(pe_mutex_t * m);
 PE_EXPORT int pe_mutex_init(pe_mutex_t * m);
 
+/* condition variables. On win32 a pe_cond_t is an auto-reset event, so
+ * only a single waiter per condition is supported there. */
+PE_EXPORT int pe_cond_init(pe_cond_t * c);
+PE_EXPORT int pe_cond_wait(pe_cond_t * c, pe_mutex_t * m);
+PE_EXPORT int pe_cond_signal(pe_cond_t * c);
+PE_EXPORT int pe_cond_broadcast(pe_cond_t * c);
+
 PE_EXPORT int pe_thread_create(pe_thread_t * t, void *func(void *), void *data);
 PE_EXPORT int pe_thread_join(pe_thread_t t);
 PE_EXPORT int pe_thread_cancel(pe_thread_t t);
+PE_EXPORT void pe_thread_yield();
+
+/* small id of the calling thread, 1 for the first thread that asks */
+PE_EXPORT unsigned int pe_thread_id();
+
+/*
+ * Spinlocks for critical sections of a few instructions. A zeroed
+ * pe_spinlock_t is unlocked, so they need no initialization.
+ */
+typedef char pe_spinlock_t;
+
+static inline void pe_spin_lock(pe_spinlock_t * l)
+{
+	while (__atomic_test_and_set(l, __ATOMIC_ACQUIRE))
+		pe_thread_yield();
+}
+
+static inline void pe_spin_unlock(pe_spinlock_t * l)
+{
+	__atomic_clear(l, __ATOMIC_RELEASE);
+}
 
 #ifdef __cplusplus
 }
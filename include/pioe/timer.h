@@ -0,0 +1,125 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	Hierarchical hashed timer wheel
+ *
+ * Time is counted in abstract ticks; the engine keeps one wheel ticking
+ * in frames and one ticking in milliseconds. A wheel has PE_TIMER_LEVELS
+ * levels of PE_TIMER_SLOTS slots each. Level n holds the timers that
+ * expire within PE_TIMER_SLOTS^(n+1) ticks, hashed by the matching bits
+ * of their expiry. When the lower level wraps around, the next slot of
+ * the level above is cascaded down, so every timer is moved at most
+ * PE_TIMER_LEVELS - 1 times.
+ *
+ * Scheduling and cancelling are O(1): timers are intrusive list nodes
+ * owned by the caller, the wheel never allocates. Advancing only touches
+ * the slots of the passed ticks and fires the due timers.
+ *
+ * A wheel is not thread-safe.
+ *
+ * @date	10/17/2026
+ * @file	timer.h
+ */
+
+#ifndef PIOENGINE_TIMER_H
+#define PIOENGINE_TIMER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "pioe/export.h"
+#include "pioe/util.h"
+
+#define PE_TIMER_BITS 6
+#define PE_TIMER_SLOTS (1 << PE_TIMER_BITS)
+#define PE_TIMER_LEVELS 4	/* 2^24 ticks, farther timers are cascaded again */
+
+typedef struct pe_timer pe_timer_t;
+typedef struct pe_timer_wheel pe_timer_wheel_t;
+
+typedef void (*pe_timer_func_t) (pe_timer_t * timer);
+
+struct pe_timer {
+	pe_dlink_t link;
+	pe_dlist_t *slot;	/* slot queued in */
+	pe_timer_wheel_t *wheel;	/* NULL if not scheduled */
+	uint64_t expires;	/* tick to fire on */
+	pe_timer_func_t func;
+	void *data;
+};
+
+struct pe_timer_wheel {
+	uint64_t now;		/* last tick advanced to */
+	size_t count;		/* scheduled timers */
+	pe_dlist_t slots[PE_TIMER_LEVELS][PE_TIMER_SLOTS];
+};
+
+PE_EXPORT void pe_timer_wheel_init(pe_timer_wheel_t * w, uint64_t now);
+
+/**
+ * @brief Advance the wheel to now and fire all timers due until then
+ *
+ * Timers fire in order of expiry. A timer is unscheduled before its func
+ * is called, so func may schedule it again.
+ *
+ * @return number of fired timers
+ */
+PE_EXPORT size_t pe_timer_wheel_advance(pe_timer_wheel_t * w, uint64_t now);
+
+/**
+ * @brief Earliest tick worth advancing to
+ *
+ * Exact for timers within PE_TIMER_SLOTS ticks, otherwise the next
+ * cascade, which is never later than the next expiry.
+ *
+ * @return 0 on success, -1 if no timer is scheduled
+ */
+PE_EXPORT int pe_timer_wheel_next(const pe_timer_wheel_t * w,
+				  uint64_t * tick);
+
+PE_EXPORT void pe_timer_init(pe_timer_t * t, pe_timer_func_t func,
+			     void *data);
+
+/**
+ * @brief Schedule t to fire on tick expires
+ *
+ * Reschedules t if it is already pending. Expiries that are not in the
+ * future fire on the next tick.
+ */
+PE_EXPORT void pe_timer_schedule(pe_timer_wheel_t * w, pe_timer_t * t,
+				 uint64_t expires);
+
+/**
+ * @brief Unschedule t
+ *
+ * @return true if t was pending
+ */
+PE_EXPORT bool pe_timer_cancel(pe_timer_t * t);
+
+static inline bool pe_timer_pending(const pe_timer_t * t)
+{
+	return t->wheel != NULL;
+}
+
+#endif
@@ -39,7 +39,10 @@
 #define PIOENGINE_UTIL_H
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
@@ -62,89 +65,382 @@ extern "C" {
 // DLL/SO begin
 PE_EXPORT void *pe_dll_open(const char *path);
 PE_EXPORT void *pe_dll_sym(void *handle, const char *symbol);
+PE_EXPORT void pe_dll_close(void *handle);
 // DLL/SO end
 
 
+// VECTOR begin
+/*
+ * Typed vectors. PE_VEC_DECLARE(name, type, small) declares name##_t and
+ * static inline functions name##_push(), name##_get(), ... for arrays of
+ * type. The first small elements are stored inline, so short vectors need
+ * no allocation; beyond that the capacity doubles, so appends are
+ * amortized O(1). A zeroed name##_t is an empty vector.
+ *
+ * Pointers to elements are invalidated by anything that changes the
+ * capacity, and by copying the vector while it is stored inline.
+ */
+#define PE_VEC_DECLARE(name, type, small) \
+typedef type name##_elem_t; \
+typedef struct name { \
+	type *heap;		/* NULL while the elements are stored inline */ \
+	size_t len; \
+	size_t cap; \
+	type inline_buf[small]; \
+} name##_t; \
+\
+static inline void name##_init(name##_t *v) \
+{ \
+	v->heap = NULL; \
+	v->len = 0; \
+	v->cap = small; \
+} \
+\
+static inline type *name##_data(name##_t *v) \
+{ \
+	return v->heap != NULL ? v->heap : v->inline_buf; \
+} \
+\
+static inline size_t name##_capacity(const name##_t *v) \
+{ \
+	return v->heap != NULL ? v->cap : (small); \
+} \
+\
+/* make room for cap elements, -1 if out of memory */ \
+static inline int name##_reserve(name##_t *v, size_t cap) \
+{ \
+	size_t ncap = name##_capacity(v); \
+	type *data; \
+	if (cap <= ncap) \
+		return 0; \
+	while (ncap < cap) \
+		ncap *= 2; \
+	if (v->heap == NULL) { \
+		data = (type *) malloc(ncap * sizeof(type)); \
+		if (data != NULL) \
+			memcpy(data, v->inline_buf, v->len * sizeof(type)); \
+	} else { \
+		data = (type *) realloc(v->heap, ncap * sizeof(type)); \
+	} \
+	if (data == NULL) \
+		return -1; \
+	v->heap = data; \
+	v->cap = ncap; \
+	return 0; \
+} \
+\
+static inline int name##_push(name##_t *v, type elem) \
+{ \
+	if (v->len == name##_capacity(v) && name##_reserve(v, v->len + 1)) \
+		return -1; \
+	name##_data(v)[v->len++] = elem; \
+	return 0; \
+} \
+\
+static inline type name##_get(name##_t *v, size_t index) \
+{ \
+	return name##_data(v)[index]; \
+} \
+\
+static inline type name##_pop(name##_t *v) \
+{ \
+	return name##_data(v)[--v->len]; \
+} \
+\
+/* O(1) removal, the last element takes the place of the removed one */ \
+static inline type name##_swap_remove(name##_t *v, size_t index) \
+{ \
+	type *data = name##_data(v); \
+	type elem = data[index]; \
+	data[index] = data[--v->len]; \
+	return elem; \
+} \
+\
+/* give back unused capacity, moving back inline if the elements fit */ \
+static inline void name##_shrink(name##_t *v) \
+{ \
+	type *data; \
+	if (v->heap == NULL || v->len == v->cap) \
+		return; \
+	if (v->len <= (small)) { \
+		memcpy(v->inline_buf, v->heap, v->len * sizeof(type)); \
+		free(v->heap); \
+		v->heap = NULL; \
+		v->cap = small; \
+		return; \
+	} \
+	data = (type *) realloc(v->heap, v->len * sizeof(type)); \
+	if (data != NULL) { \
+		v->heap = data; \
+		v->cap = v->len; \
+	} \
+} \
+\
+static inline void name##_free(name##_t *v) \
+{ \
+	free(v->heap); \
+	name##_init(v); \
+}
+
+#define pe_vec_each(name, v, elem, counter) \
+	for (counter = 0; counter < (v)->len; counter++) { \
+		name##_elem_t elem = name##_get(v, counter);
+
+#define pe_end }
+
+#define pe_vec_count(v) ((v)->len)
+// VECTOR end
+
 // LIST begin
-#define PE_LIST_STEP 2048   /*  values < 2048 take ~15msec on my system
-                                to init the list. >= 2048 takes 0msec... */
+#define pe_container_of(ptr, type, member) \
+	((type *) ((char *) (ptr) - offsetof(type, member)))
 
-typedef struct _pe_list {
-	void *values;
-	size_t used;
-	size_t size;
-    size_t step;
-} pe_list_t;
+/*
+ * Intrusive doubly-linked list. Objects embed a pe_dlink_t and are linked
+ * without any allocation, pe_container_of() gets back to the object. The
+ * list keeps head, tail and count, so every operation but iteration is
+ * O(1). A zeroed pe_dlist_t is an empty list.
+ */
+typedef struct pe_dlink {
+	struct pe_dlink *next;
+	struct pe_dlink *prev;
+} pe_dlink_t;
+
+typedef struct pe_dlist {
+	pe_dlink_t *head;
+	pe_dlink_t *tail;
+	size_t count;
+} pe_dlist_t;
+
+static inline void pe_dlist_init(pe_dlist_t *l)
+{
+	l->head = l->tail = NULL;
+	l->count = 0;
+}
 
-typedef struct _pe_llist pe_llist_t;
+static inline bool pe_dlist_empty(const pe_dlist_t *l)
+{
+	return l->head == NULL;
+}
 
-typedef struct _pe_llist {
+/* insert at the head */
+static inline void pe_dlist_push(pe_dlist_t *l, pe_dlink_t *n)
+{
+	n->prev = NULL;
+	n->next = l->head;
+	if (l->head != NULL)
+		l->head->prev = n;
+	else
+		l->tail = n;
+	l->head = n;
+	l->count++;
+}
+
+/* insert at the tail */
+static inline void pe_dlist_append(pe_dlist_t *l, pe_dlink_t *n)
+{
+	n->next = NULL;
+	n->prev = l->tail;
+	if (l->tail != NULL)
+		l->tail->next = n;
+	else
+		l->head = n;
+	l->tail = n;
+	l->count++;
+}
+
+/* n must be linked in l */
+static inline void pe_dlist_remove(pe_dlist_t *l, pe_dlink_t *n)
+{
+	if (n->prev != NULL)
+		n->prev->next = n->next;
+	else
+		l->head = n->next;
+	if (n->next != NULL)
+		n->next->prev = n->prev;
+	else
+		l->tail = n->prev;
+	n->next = n->prev = NULL;
+	l->count--;
+}
+
+/* unlink the head, NULL if empty */
+static inline pe_dlink_t *pe_dlist_shift(pe_dlist_t *l)
+{
+	pe_dlink_t *n = l->head;
+	if (n != NULL)
+		pe_dlist_remove(l, n);
+	return n;
+}
+
+/* unlink the tail, NULL if empty */
+static inline pe_dlink_t *pe_dlist_pop(pe_dlist_t *l)
+{
+	pe_dlink_t *n = l->tail;
+	if (n != NULL)
+		pe_dlist_remove(l, n);
+	return n;
+}
+
+/* move all nodes of from to the tail of to */
+static inline void pe_dlist_concat(pe_dlist_t *to, pe_dlist_t *from)
+{
+	if (from->head == NULL)
+		return;
+	if (to->tail != NULL) {
+		to->tail->next = from->head;
+		from->head->prev = to->tail;
+	} else {
+		to->head = from->head;
+	}
+	to->tail = from->tail;
+	to->count += from->count;
+	pe_dlist_init(from);
+}
+
+/* the loop body must not unlink link, use pe_dlist_shift() to drain */
+#define pe_dlist_each(l, link) \
+	for (link = (l)->head; link != NULL; link = link->next)
+
+/*
+ * Non-intrusive list of pointers on top of pe_dlist_t, one node is
+ * allocated per value.
+ */
+typedef struct pe_llist_node {
+	pe_dlink_t link;
 	void *value;
-	pe_llist_t *next;
-	pe_llist_t *prev;
+} pe_llist_node_t;
+
+typedef struct _pe_llist {
+	pe_dlist_t nodes;
 } pe_llist_t;
 
 PE_EXPORT pe_llist_t *pe_llist();
+PE_EXPORT void pe_llist_free(pe_llist_t *l);
+/* remove and return the last value, NULL if empty */
 PE_EXPORT void *pe_llist_pop(pe_llist_t *l);
-PE_EXPORT void *pe_llist_shift(pe_llist_t **l);
-PE_EXPORT int pe_llist_push(pe_llist_t **l, void * val);
+/* remove and return the first value, NULL if empty */
+PE_EXPORT void *pe_llist_shift(pe_llist_t *l);
+/* insert val at the front */
+PE_EXPORT int pe_llist_push(pe_llist_t *l, void * val);
+/* insert val at the back */
 PE_EXPORT int pe_llist_append(pe_llist_t *l, void * val);
-PE_EXPORT int pe_llist_count(pe_llist_t *l);
+PE_EXPORT size_t pe_llist_count(pe_llist_t *l);
+
+static inline pe_llist_node_t *pe_llist_first(pe_llist_t *l)
+{
+	return l->nodes.head == NULL ? NULL :
+	    pe_container_of(l->nodes.head, pe_llist_node_t, link);
+}
+
+static inline pe_llist_node_t *pe_llist_next(pe_llist_node_t *n)
+{
+	return n->link.next == NULL ? NULL :
+	    pe_container_of(n->link.next, pe_llist_node_t, link);
+}
 
 #define LL_EXPAND(key) _EXPAND(llist, key)
 
 #define LL_(key) \
 	static pe_llist_t *LL_EXPAND(key) = NULL; \
-	static pe_llist_t *LL_EXPAND(key##_current) = NULL;
+	static pe_llist_node_t *LL_EXPAND(key##_current) = NULL;
 
 #define LL_INIT(key) LL_EXPAND(key) = pe_llist();
-#define LL_PUSH(key, value) pe_llist_push(&LL_EXPAND(key), (void*) value);
-#define LL_SHIFT(key, type) (type) pe_llist_shift(&LL_EXPAND(key));
-#define LL_POP(key, type) (type) pe_llist_pop(LL_EXPAND(key));
+#define LL_PUSH(key, value) pe_llist_push(LL_EXPAND(key), (void*) value);
+#define LL_APPEND(key, value) pe_llist_append(LL_EXPAND(key), (void*) value);
+#define LL_SHIFT(key, type) ((type) pe_llist_shift(LL_EXPAND(key)))
+#define LL_POP(key, type) ((type) pe_llist_pop(LL_EXPAND(key)))
 #define LL_EACH(key, type, elem) \
-	LL_EXPAND(key##_current) = LL_EXPAND(key); \
-	while(LL_EXPAND(key##_current)->next != NULL) { \
-		type elem = (type) LL_EXPAND(key##_current)->value; \
-		LL_EXPAND(key##_current) = LL_EXPAND(key##_current)->next;
+	for (LL_EXPAND(key##_current) = pe_llist_first(LL_EXPAND(key)); \
+	     LL_EXPAND(key##_current) != NULL; \
+	     LL_EXPAND(key##_current) = pe_llist_next(LL_EXPAND(key##_current))) { \
+		type elem = (type) LL_EXPAND(key##_current)->value;
 
 #define LL_END() }
 #define LL_COUNT(key) pe_llist_count(LL_EXPAND(key))
-
-#define pe_list_init(lst, type, len) \
-	lst = malloc(sizeof(pe_list_t)); \
-	lst->values = (type *) malloc(len * sizeof(type)); \
-	lst->used = 0; \
-    lst->step = len >= 1 ? len : PE_LIST_STEP; \
-	lst->size = len;
-
-#define pe_list_add(lst, type, elem) \
-	if (lst->used == lst->size) { \
-		lst->size += lst->step; \
-		lst->values = (type *) realloc(lst->values, lst->size * sizeof(type)); \
-	} \
-	((type *)lst->values)[lst->used++] = elem;
-
-#define pe_list_get(lst, type, index) \
-	((type *)lst->values)[index]
-
-#define pe_list_each(lst, type, elem, counter) \
-	for(counter = 0; counter < lst->used; counter++) { \
-		type elem = pe_list_get(lst, type, counter); \
-
-#define pe_end }
-
-#define pe_list_count(lst) lst->used
-
-#define pe_list_free(lst) \
-	free(lst->values); \
-	free(lst);
+#define LL_FREE(key) \
+	pe_llist_free(LL_EXPAND(key)); \
+	LL_EXPAND(key) = NULL;
 
 // LIST end
 
+// MAP begin
+/*
+ * Open-addressing hash map from string or integer keys to pointers.
+ * Linear probing on a power-of-two table kept at most 3/4 full; hashes
+ * are cached so probes only compare keys on a hash match, and removal
+ * shifts the following entries back instead of leaving tombstones.
+ * String keys are copied. A zeroed pe_map_t is an empty MAP_STR map.
+ */
+typedef enum {
+	MAP_STR,
+	MAP_STR_NOCASE,
+	MAP_INT,
+} pe_map_key_t;
+
+typedef struct pe_map_entry {
+	uint64_t hash;		/* 0 if the slot is free */
+	union {
+		char *s;
+		uint64_t i;
+	} key;
+	void *value;
+} pe_map_entry_t;
+
+typedef struct pe_map {
+	pe_map_entry_t *entries;
+	size_t mask;		/* slots - 1 */
+	size_t count;
+	pe_map_key_t type;
+} pe_map_t;
+
+/* capacity is a hint of how many entries the map will hold */
+PE_EXPORT int pe_map_init(pe_map_t *m, pe_map_key_t type, size_t capacity);
+PE_EXPORT void pe_map_free(pe_map_t *m);
+
+/* insert or replace, -1 if out of memory */
+PE_EXPORT int pe_map_put(pe_map_t *m, const char *key, void *value);
+/* NULL if key is not in m */
+PE_EXPORT void *pe_map_get(const pe_map_t *m, const char *key);
+/* remove key and return its value, NULL if key is not in m */
+PE_EXPORT void *pe_map_remove(pe_map_t *m, const char *key);
+
+PE_EXPORT int pe_map_put_int(pe_map_t *m, uint64_t key, void *value);
+PE_EXPORT void *pe_map_get_int(const pe_map_t *m, uint64_t key);
+PE_EXPORT void *pe_map_remove_int(pe_map_t *m, uint64_t key);
+
+#define pe_map_count(m) ((m)->count)
+
+/* visits the entries in no particular order, m must not change meanwhile */
+#define pe_map_each(m, entry, counter) \
+	for (counter = 0; (m)->entries != NULL && counter <= (m)->mask; counter++) { \
+		pe_map_entry_t *entry = &((m)->entries[counter]); \
+		if (entry->hash == 0) \
+			continue;
+// MAP end
+
 PE_EXPORT void pe_sleep(int ms);
 PE_EXPORT uint64_t pe_tstamp_msec();
 PE_EXPORT uint64_t pe_tstamp_usec();
 
+/* monotonic clock in usec, only useful for computing intervals/deadlines */
+PE_EXPORT uint64_t pe_tstamp_mono_usec();
+/* sleep until the monotonic clock reaches deadline (see pe_tstamp_mono_usec) */
+PE_EXPORT void pe_sleep_until(uint64_t deadline);
+
+/*
+ * Virtual clock for simulations. While enabled, pe_tstamp_usec(),
+ * pe_tstamp_msec() and pe_tstamp_mono_usec() only move when the clock is
+ * advanced, and pe_sleep_until() advances it to the deadline instead of
+ * sleeping. The clock starts at the real time it was enabled at.
+ * pe_sleep() still sleeps.
+ */
+PE_EXPORT void pe_clock_set_virtual(bool enable);
+PE_EXPORT bool pe_clock_is_virtual();
+PE_EXPORT void pe_clock_advance(uint64_t usec);
+/* pe_tstamp_mono_usec() ignoring the virtual clock, to measure real work */
+PE_EXPORT uint64_t pe_tstamp_mono_real_usec();
+
 typedef struct _perfmon {
 	char *name;
 	uint64_t start_time;
@@ -0,0 +1,150 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pioe/arena.h"
+#include "pioe/thread.h"
+
+#define ALIGN (sizeof(long double) > sizeof(void *) ? \
+	       sizeof(long double) : sizeof(void *))
+#define ALIGN_UP(n) (((n) + ALIGN - 1) & ~(ALIGN - 1))
+
+struct pe_arena_block {
+	pe_arena_block_t *next;
+	size_t size;
+	size_t used;
+	long double data[];	/* aligned for any type */
+};
+
+static PE_THREAD_LOCAL pe_arena_t *current = NULL;
+
+static pe_arena_block_t *block_new(size_t size)
+{
+	pe_arena_block_t *b = malloc(sizeof(pe_arena_block_t) + size);
+
+	if (b == NULL)
+		return NULL;
+
+	b->next = NULL;
+	b->size = size;
+	b->used = 0;
+	return b;
+}
+
+static void blocks_free(pe_arena_block_t * b)
+{
+	pe_arena_block_t *next;
+
+	for (; b != NULL; b = next) {
+		next = b->next;
+		free(b);
+	}
+}
+
+PE_EXPORT int pe_arena_init(pe_arena_t * a, size_t block_size)
+{
+	a->block_size = block_size != 0 ? block_size : PE_ARENA_BLOCK_SIZE;
+	a->used = 0;
+	a->high = 0;
+	a->blocks = block_new(a->block_size);
+	return a->blocks != NULL ? 0 : -1;
+}
+
+PE_EXPORT void pe_arena_free(pe_arena_t * a)
+{
+	blocks_free(a->blocks);
+	a->blocks = NULL;
+	a->used = 0;
+}
+
+PE_EXPORT void *pe_arena_alloc(pe_arena_t * a, size_t size)
+{
+	pe_arena_block_t *b = a->blocks;
+	void *ptr;
+
+	size = ALIGN_UP(size != 0 ? size : 1);
+
+	if (b == NULL || b->size - b->used < size) {
+		b = block_new(size > a->block_size ? size : a->block_size);
+		if (b == NULL)
+			return NULL;
+		b->next = a->blocks;
+		a->blocks = b;
+	}
+
+	ptr = (char *)b->data + b->used;
+	b->used += size;
+	a->used += size;
+	return ptr;
+}
+
+PE_EXPORT char *pe_arena_strdup(pe_arena_t * a, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *dup = pe_arena_alloc(a, len);
+
+	if (dup != NULL)
+		memcpy(dup, s, len);
+	return dup;
+}
+
+PE_EXPORT void pe_arena_reset(pe_arena_t * a)
+{
+	pe_arena_block_t *b = a->blocks;
+	size_t total = 0;
+
+	if (a->used > a->high)
+		a->high = a->used;
+	a->used = 0;
+
+	if (b == NULL)
+		return;
+
+	/* several blocks: replace them by one that fits a whole frame */
+	if (b->next != NULL) {
+		for (; b != NULL; b = b->next)
+			total += b->size;
+		b = block_new(total);
+		if (b != NULL) {
+			blocks_free(a->blocks);
+			a->blocks = b;
+		} else {
+			b = a->blocks;
+		}
+	}
+
+	for (; b != NULL; b = b->next)
+		b->used = 0;
+}
+
+PE_EXPORT pe_arena_t *pe_arena_current()
+{
+	return current;
+}
+
+PE_EXPORT void pe_arena_set_current(pe_arena_t * a)
+{
+	current = a;
+}
@@ -0,0 +1,619 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pioe/binlog.h"
+#include "pioe/engine.h"
+#include "pioe/error.h"
+#include "pioe/symbol.h"
+#include "pioe/thread.h"
+#include "pioe/util.h"
+
+#define BINLOG_BUFFER_SIZE (64 * 1024)
+
+#define STR_SIZE (2 + LOGGER_MAX_LEN)
+#define ENTRY_HEADER (1 + 4 + 4 + 8 + 8 + 4)
+#define TEXT_SIZE (1 + 1 + 4 + 8 + 8 + 4 + 4 + 3 * STR_SIZE)
+#define SITE_SIZE (1 + 4 + 1 + 4 + 1 + PE_LOG_SITE_ARGS + 3 * STR_SIZE)
+
+/* written by its thread, flushed by any thread holding lock */
+struct binlog_buffer {
+	pe_spinlock_t lock;
+	size_t len;
+	unsigned char data[BINLOG_BUFFER_SIZE];
+};
+
+struct site_def {
+	pe_log_site_t *site;
+	pe_loglevel_t level;
+	const char *format;
+	const char *file;
+	const char *func;
+	unsigned int line;
+};
+
+PE_VEC_DECLARE(binlog_buffer_vec, struct binlog_buffer *, 16)
+PE_VEC_DECLARE(site_def_vec, struct site_def, 64)
+
+/*
+ * Lock order is a buffer's spinlock before binlog_mutex, which guards
+ * the file and everything below it.
+ */
+static FILE *binlog;
+static pe_mutex_t binlog_mutex;
+static unsigned int binlog_gen;
+static binlog_buffer_vec_t buffers;
+static site_def_vec_t sites;
+static uint32_t names_written;
+
+static PE_THREAD_LOCAL struct binlog_buffer *thread_buffer;
+static PE_THREAD_LOCAL unsigned int thread_gen;
+
+static unsigned char *put_u8(unsigned char *p, uint8_t v)
+{
+	*p = v;
+	return p + 1;
+}
+
+static unsigned char *put_u16(unsigned char *p, uint16_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static unsigned char *put_u32(unsigned char *p, uint32_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+static unsigned char *put_u64(unsigned char *p, uint64_t v)
+{
+	memcpy(p, &v, sizeof(v));
+	return p + sizeof(v);
+}
+
+/* at most max bytes of s, which needs no '\0' within them */
+static unsigned char *put_strn(unsigned char *p, const char *s, size_t max)
+{
+	const char *end;
+	size_t len;
+
+	if (NULL == s)
+		s = "(null)";
+	if (max > LOGGER_MAX_LEN)
+		max = LOGGER_MAX_LEN;
+	end = memchr(s, '\0', max);
+	len = end != NULL ? (size_t)(end - s) : max;
+	p = put_u16(p, len);
+	memcpy(p, s, len);
+	return p + len;
+}
+
+static unsigned char *put_str(unsigned char *p, const char *s)
+{
+	return put_strn(p, s, LOGGER_MAX_LEN);
+}
+
+PE_EXPORT const char *pe_binlog_spec(const char *format, size_t *len,
+				     pe_log_arg_t types[3], int *ntypes)
+{
+	const char *p = format;
+	const char *start;
+	enum { NONE, HH, H, L, LL, J, Z, T, BIG_L } size;
+	bool ok;
+	int n;
+
+	while ((p = strchr(p, '%')) != NULL) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+
+		start = p++;
+		ok = true;
+		n = 0;
+
+		while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+			p++;
+
+		if (*p == '*') {
+			types[n++] = LOG_ARG_INT;
+			p++;
+		} else {
+			while (isdigit((unsigned char)*p))
+				p++;
+			/* positional arguments */
+			if (*p == '$')
+				ok = false;
+		}
+
+		if (*p == '.') {
+			p++;
+			if (*p == '*') {
+				types[n++] = LOG_ARG_INT;
+				p++;
+			} else {
+				while (isdigit((unsigned char)*p))
+					p++;
+			}
+		}
+
+		size = NONE;
+		switch (*p) {
+		case 'h':
+			size = p[1] == 'h' ? HH : H;
+			break;
+		case 'l':
+			size = p[1] == 'l' ? LL : L;
+			break;
+		case 'q':
+			size = LL;
+			break;
+		case 'j':
+			size = J;
+			break;
+		case 'z':
+		case 'Z':
+			size = Z;
+			break;
+		case 't':
+			size = T;
+			break;
+		case 'L':
+			size = BIG_L;
+			break;
+		}
+		if (size == HH || (size == LL && *p == 'l'))
+			p += 2;
+		else if (size != NONE)
+			p++;
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			switch (size) {
+			case L:
+				types[n++] = LOG_ARG_LONG;
+				break;
+			case LL:
+				types[n++] = LOG_ARG_LLONG;
+				break;
+			case J:
+				types[n++] = LOG_ARG_INTMAX;
+				break;
+			case Z:
+				types[n++] = LOG_ARG_SIZE;
+				break;
+			case T:
+				types[n++] = LOG_ARG_PTRDIFF;
+				break;
+			case BIG_L:
+				ok = false;
+				break;
+			default:
+				types[n++] = LOG_ARG_INT;
+			}
+			break;
+		case 'c':
+			ok = ok && size == NONE;
+			types[n++] = LOG_ARG_INT;
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			ok = ok && (size == NONE || size == L);
+			types[n++] = LOG_ARG_DOUBLE;
+			break;
+		case 's':
+			ok = ok && size == NONE;
+			types[n++] = LOG_ARG_STRING;
+			break;
+		case 'p':
+			types[n++] = LOG_ARG_POINTER;
+			break;
+		case '\0':
+			/* a conversion cut off by the end of the format */
+			*len = p - start;
+			*ntypes = -1;
+			return start;
+		default:
+			ok = false;
+		}
+
+		*len = p + 1 - start;
+		*ntypes = ok ? n : -1;
+		return start;
+	}
+
+	return NULL;
+}
+
+/* names are written before any buffer that may refer to them */
+static void write_names()
+{
+	unsigned char rec[1 + 4 + STR_SIZE];
+	unsigned char *p;
+	uint32_t count = pe_symbol_count();
+
+	for (; names_written < count; names_written++) {
+		p = put_u8(rec, BINLOG_NAME);
+		p = put_u32(p, names_written + 1);
+		p = put_str(p, pe_symbol_by_id(names_written + 1));
+		fwrite(rec, 1, p - rec, binlog);
+	}
+}
+
+static void write_site(const struct site_def *d)
+{
+	unsigned char rec[SITE_SIZE];
+	unsigned char *p;
+	const pe_log_site_t *site = d->site;
+
+	p = put_u8(rec, BINLOG_SITE);
+	p = put_u32(p, site->id);
+	p = put_u8(p, d->level);
+	p = put_u32(p, d->line);
+	p = put_u8(p, site->nargs);
+	memcpy(p, site->types, site->nargs);
+	p += site->nargs;
+	p = put_str(p, d->format);
+	p = put_str(p, d->file);
+	p = put_str(p, d->func);
+	fwrite(rec, 1, p - rec, binlog);
+}
+
+/* with b->lock held */
+static void buffer_write(struct binlog_buffer *b)
+{
+	pe_mutex_lock(&binlog_mutex);
+	if (binlog != NULL && b->len > 0) {
+		write_names();
+		fwrite(b->data, 1, b->len, binlog);
+	}
+	b->len = 0;
+	pe_mutex_unlock(&binlog_mutex);
+}
+
+static struct binlog_buffer *my_buffer()
+{
+	struct binlog_buffer *b;
+
+	unsigned int gen = __atomic_load_n(&binlog_gen, __ATOMIC_ACQUIRE);
+
+	if (thread_buffer != NULL && thread_gen == gen)
+		return thread_buffer;
+
+	b = calloc(1, sizeof(struct binlog_buffer));
+	if (NULL == b)
+		return NULL;
+
+	pe_mutex_lock(&binlog_mutex);
+	if (binlog_buffer_vec_push(&buffers, b)) {
+		pe_mutex_unlock(&binlog_mutex);
+		free(b);
+		return NULL;
+	}
+	pe_mutex_unlock(&binlog_mutex);
+
+	thread_buffer = b;
+	thread_gen = gen;
+	return b;
+}
+
+/* locks the buffer and makes room for size bytes */
+static unsigned char *reserve(struct binlog_buffer *b, size_t size)
+{
+	pe_spin_lock(&b->lock);
+	if (BINLOG_BUFFER_SIZE - b->len < size)
+		buffer_write(b);
+	return b->data + b->len;
+}
+
+static void commit(struct binlog_buffer *b, unsigned char *end)
+{
+	b->len = end - b->data;
+	pe_spin_unlock(&b->lock);
+}
+
+static void site_register(pe_log_site_t * site, pe_loglevel_t level,
+			  const char *file, const char *func,
+			  unsigned int line, const char *format)
+{
+	struct site_def d = {
+		.site = site,
+		.level = level,
+		.format = format,
+		.file = file,
+		.func = func,
+		.line = line,
+	};
+	pe_log_arg_t types[3];
+	const char *p = format, *dot;
+	size_t len;
+	int i, n;
+
+	pe_mutex_lock(&binlog_mutex);
+	if (site->id != 0) {
+		pe_mutex_unlock(&binlog_mutex);
+		return;
+	}
+
+	site->nargs = 0;
+	site->precision = 0;
+	site->max_size = ENTRY_HEADER;
+	while ((p = pe_binlog_spec(p, &len, types, &n)) != NULL) {
+		if (n < 0 || site->nargs + n > PE_LOG_SITE_ARGS) {
+			site->dynamic = true;
+			break;
+		}
+		/* "%.*s" reads no further than the precision */
+		dot = memchr(p, '.', len);
+		if (n > 1 && types[n - 1] == LOG_ARG_STRING && dot != NULL
+		    && dot[1] == '*')
+			site->precision |= 1 << (site->nargs + n - 2);
+		for (i = 0; i < n; i++) {
+			site->types[site->nargs++] = types[i];
+			site->max_size +=
+			    types[i] == LOG_ARG_STRING ? STR_SIZE : 8;
+		}
+		p += len;
+	}
+	if (site->dynamic)
+		site->nargs = 0;
+
+	if (site_def_vec_push(&sites, d) == 0) {
+		__atomic_store_n(&site->id, pe_vec_count(&sites),
+				 __ATOMIC_RELEASE);
+		if (binlog != NULL)
+			write_site(&d);
+	} else {
+		site->dynamic = true;
+	}
+	pe_mutex_unlock(&binlog_mutex);
+}
+
+static int write_text(const pe_logger_t * logger, pe_loglevel_t level,
+		      const char *file, const char *func,
+		      unsigned int line, const char *format, va_list * args)
+{
+	struct binlog_buffer *b = my_buffer();
+	char msg[LOGGER_MAX_LEN];
+	unsigned char *p;
+	va_list copy;
+
+	if (NULL == b)
+		return -1;
+
+	va_copy(copy, *args);
+	vsnprintf(msg, sizeof(msg), format, copy);
+	va_end(copy);
+
+	p = reserve(b, TEXT_SIZE);
+	p = put_u8(p, BINLOG_TEXT);
+	p = put_u8(p, level);
+	p = put_u32(p, pe_symbol_id(logger->name));
+	p = put_u64(p, pe_tstamp_usec());
+	p = put_u64(p, pe_engine_frame_id());
+	p = put_u32(p, pe_thread_id());
+	p = put_u32(p, line);
+	p = put_str(p, file);
+	p = put_str(p, func);
+	p = put_str(p, msg);
+	commit(b, p);
+	return 0;
+}
+
+PE_EXPORT int pe_binlog_text(const pe_logger_t * logger, pe_loglevel_t level,
+			     const char *file, const char *func,
+			     unsigned int line, const char *format,
+			     va_list * args)
+{
+	if (__atomic_load_n(&binlog, __ATOMIC_ACQUIRE) == NULL)
+		return -1;
+
+	return write_text(logger, level, file, func, line, format, args);
+}
+
+PE_EXPORT int pe_binlog_entry(pe_log_site_t * site, const pe_logger_t * logger,
+			      pe_loglevel_t level, const char *file,
+			      const char *func, unsigned int line,
+			      const char *format, va_list * args)
+{
+	struct binlog_buffer *b;
+	unsigned char *p;
+	int i, v, precision = -1;
+
+	if (__atomic_load_n(&binlog, __ATOMIC_ACQUIRE) == NULL)
+		return -1;
+
+	if (__atomic_load_n(&site->id, __ATOMIC_ACQUIRE) == 0)
+		site_register(site, level, file, func, line, format);
+
+	if (site->dynamic)
+		return write_text(logger, level, file, func, line, format,
+				  args);
+
+	if (NULL == (b = my_buffer()))
+		return -1;
+
+	p = reserve(b, site->max_size);
+	p = put_u8(p, BINLOG_ENTRY);
+	p = put_u32(p, site->id);
+	p = put_u32(p, pe_symbol_id(logger->name));
+	p = put_u64(p, pe_tstamp_usec());
+	p = put_u64(p, pe_engine_frame_id());
+	p = put_u32(p, pe_thread_id());
+
+	for (i = 0; i < site->nargs; i++) {
+		switch (site->types[i]) {
+		case LOG_ARG_INT:
+			v = va_arg(*args, int);
+			if (site->precision & (1 << i))
+				precision = v;
+			p = put_u32(p, v);
+			break;
+		case LOG_ARG_LONG:
+			p = put_u64(p, va_arg(*args, long));
+			break;
+		case LOG_ARG_LLONG:
+			p = put_u64(p, va_arg(*args, long long));
+			break;
+		case LOG_ARG_INTMAX:
+			p = put_u64(p, va_arg(*args, intmax_t));
+			break;
+		case LOG_ARG_SIZE:
+			p = put_u64(p, va_arg(*args, size_t));
+			break;
+		case LOG_ARG_PTRDIFF:
+			p = put_u64(p, va_arg(*args, ptrdiff_t));
+			break;
+		case LOG_ARG_DOUBLE: {
+				double d = va_arg(*args, double);
+				memcpy(p, &d, sizeof(d));
+				p += sizeof(d);
+				break;
+			}
+		case LOG_ARG_POINTER:
+			p = put_u64(p, (uintptr_t) va_arg(*args, void *));
+			break;
+		case LOG_ARG_STRING:
+			/* a negative precision is no precision */
+			p = put_strn(p, va_arg(*args, const char *),
+				     precision < 0 ? LOGGER_MAX_LEN : precision);
+			precision = -1;
+			break;
+		}
+	}
+
+	commit(b, p);
+	return 0;
+}
+
+PE_EXPORT void pe_binlog_flush()
+{
+	struct binlog_buffer *b;
+	size_t i;
+
+	if (__atomic_load_n(&binlog, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	for (i = 0;; i++) {
+		pe_mutex_lock(&binlog_mutex);
+		b = i < pe_vec_count(&buffers) ?
+		    binlog_buffer_vec_get(&buffers, i) : NULL;
+		pe_mutex_unlock(&binlog_mutex);
+		if (NULL == b)
+			break;
+
+		pe_spin_lock(&b->lock);
+		buffer_write(b);
+		pe_spin_unlock(&b->lock);
+	}
+
+	pe_mutex_lock(&binlog_mutex);
+	fflush(binlog);
+	pe_mutex_unlock(&binlog_mutex);
+}
+
+/*
+ * Threads may still log while exit() runs, so the buffers must stay.
+ * Only write them out, stdio closes the file.
+ */
+static void binlog_exit()
+{
+	pe_binlog_flush();
+}
+
+PE_EXPORT int pe_logger_binary_open(const char *path)
+{
+	static bool registered = false;
+	uint32_t version = PE_BINLOG_VERSION;
+	FILE *fp;
+	int i;
+
+	if (binlog != NULL)
+		return PE_ERROR(-1, "a binary log is already open");
+
+	fp = fopen(path, "wb");
+	if (NULL == fp)
+		return PE_ERROR(-1, "could not open %s: %s", path,
+				pe_error_str(pe_errno()));
+
+	if (!registered) {
+		pe_mutex_init(&binlog_mutex);
+		binlog_buffer_vec_init(&buffers);
+		site_def_vec_init(&sites);
+		atexit(binlog_exit);
+		registered = true;
+	}
+
+	fwrite(PE_BINLOG_MAGIC, 1, PE_BINLOG_MAGIC_LEN, fp);
+	fwrite(&version, sizeof(version), 1, fp);
+
+	pe_mutex_lock(&binlog_mutex);
+	binlog = fp;
+	names_written = 0;
+	/* sites already known from an earlier binary log */
+	pe_vec_each(site_def_vec, &sites, d, i) {
+		write_site(&d);
+	}
+	pe_end;
+	__atomic_store_n(&binlog, fp, __ATOMIC_RELEASE);
+	pe_mutex_unlock(&binlog_mutex);
+
+	return 0;
+}
+
+PE_EXPORT void pe_logger_binary_close()
+{
+	int i;
+
+	if (NULL == binlog)
+		return;
+
+	pe_binlog_flush();
+
+	pe_mutex_lock(&binlog_mutex);
+	fclose(binlog);
+	__atomic_store_n(&binlog, NULL, __ATOMIC_RELEASE);
+
+	pe_vec_each(binlog_buffer_vec, &buffers, b, i) {
+		free(b);
+	}
+	pe_end;
+	binlog_buffer_vec_free(&buffers);
+	__atomic_add_fetch(&binlog_gen, 1, __ATOMIC_RELEASE);
+	pe_mutex_unlock(&binlog_mutex);
+}
@@ -26,24 +26,66 @@
 #include "pioe/error.h"
 #include "pioe/util.h"
 #include "pioe/thread.h"
+#include "pioe/record.h"
 #include "config.h"
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <limits.h>
+#include <inttypes.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#endif
 
 static void sigint_handler(int sig);
 
 static pe_thread_t threads[MAX_ENGINES];
 static size_t threads_i = 0;
 
-static pe_list_t *engine_handles = NULL;
-static pe_engine_state_t current_state = STATE_STOP;
+PE_VEC_DECLARE(pe_handle_vec, pe_engine_handle_t *, 8)
+
+static pe_handle_vec_t engine_handles;
+static pe_map_t engines_by_suffix;	/* the first loaded engine wins */
+static pe_map_t engines_by_name = { .type = MAP_STR_NOCASE };
+static pe_map_t engines_by_ptr = { .type = MAP_INT };
+static volatile pe_engine_state_t current_state = STATE_STOP;
 static pe_frame_t frame;
 
+static unsigned int frame_rate = PIOE_FRAME_RATE;
+static uint64_t frame_period = 1000000 / PIOE_FRAME_RATE;
+static pe_overrun_policy_t overrun_policy = OVERRUN_DROP;
+static uint64_t frames_dropped = 0;
+static pe_run_mode_t run_mode = RUN_FIXED;
+static bool coalesce = true;
+static size_t queue_capacity = PIOE_EVENT_QUEUE_SIZE;
+static pe_queue_policy_t queue_policy = QUEUE_DROP_NEWEST;
+
+static pe_record_t recording;
+static pe_record_t *recorder = NULL;
+static pe_engine_handle_t *record_source = NULL;	/* engine recorded */
+static pe_record_t replay;
+static pe_record_t *replayer = NULL;
+static uint64_t simulate_frames = 0;
+
+#ifdef __linux__
+static int epoll_fd = -1;
+static int event_fd = -1;
+static int timer_fd = -1;
+static pe_mutex_t wakeup_mutex;
+static uint64_t wakeup_deadline = UINT64_MAX;
+
+static int event_loop_init();
+#endif
+
 #define CHECK_ENGINE_AVAIL \
-	if(pe_list_count(engine_handles) == 0) \
+	if(pe_vec_count(&engine_handles) == 0) \
 		PE_ABORT(-1,"NO ENGINE AVAILABLE");
 
 #if defined(_WIN32)
@@ -61,6 +103,11 @@ static const char *_engine_search_path[] =
     { "./", "./engines/", "./lib/", "../lib/", "../lib/pioe/", "" };
 #endif
 
+static pe_manifest_t manifest;
+static bool manifest_ready = false;
+static bool manifest_rescan = false;
+static bool manifest_cached = false;	/* read from the cache file */
+
 static char *_compute_lib_path(const char *key)
 {
 	char res[1024];
@@ -72,15 +119,71 @@ static char *_compute_lib_path(const char *key)
 static void sigint_handler(int sig)
 {
 	LOG_DEBUG("Signal %i received", sig);
-	pe_engine_quit();
+	current_state = STATE_STOP;
+#ifdef __linux__
+	/* event mode may sit in epoll_wait(), write() is signal safe */
+	uint64_t one = 1;
+	if (event_fd >= 0)
+		write(event_fd, &one, sizeof(one));
+#endif
+}
+
+/* the cached manifest if it is still valid, a fresh scan otherwise */
+static pe_manifest_t *engine_manifest()
+{
+	const char *file = pe_manifest_default_file();
+
+	if (manifest_ready)
+		return &manifest;
+
+	manifest_cached = true;
+	if (manifest_rescan || NULL == file
+	    || pe_manifest_load(&manifest, file, _engine_search_path,
+				ARRAY_SIZE(_engine_search_path)) != 0) {
+		manifest_cached = false;
+		LOG_DEBUG("Scanning for engines");
+		pe_manifest_scan(&manifest, _engine_search_path,
+				 ARRAY_SIZE(_engine_search_path),
+				 LIB_PREFIX "pioe", "engine." LIB_SUFFIX);
+		if (NULL != file && pe_manifest_save(&manifest, file))
+			LOG_WARN("Could not cache engine manifest in %s", file);
+	}
+
+	manifest_rescan = false;
+	manifest_ready = true;
+	return &manifest;
+}
+
+PE_EXPORT void pe_engine_rescan()
+{
+	if (manifest_ready)
+		pe_manifest_free(&manifest);
+	manifest_ready = false;
+	manifest_rescan = true;
+}
+
+PE_EXPORT size_t pe_engine_list(const pe_engine_info_t ** engines)
+{
+	pe_manifest_t *m = engine_manifest();
+	const char *file = pe_manifest_default_file();
+
+	/* only listing needs the metadata, loading by name goes by key */
+	if (pe_manifest_probe(m) > 0 && NULL != file
+	    && pe_manifest_save(m, file))
+		LOG_WARN("Could not cache engine manifest in %s", file);
+
+	*engines = pe_engine_info_vec_data(&(m->engines));
+	return m->engines.len;
 }
 
 PE_EXPORT size_t pe_engine_find_engines(char **results)
 {
-	return pe_find_file(_engine_search_path,
-			    ARRAY_SIZE(_engine_search_path),
-			    _compute_lib_path("*"), results, 0);
+	const pe_engine_info_t *engines;
+	size_t i, len = pe_engine_list(&engines);
 
+	for (i = 0; i < len; i++)
+		results[i] = strdup(engines[i].path);
+	return len;
 }
 
 PE_EXPORT int pe_engine_load_by_name(const char *name)
@@ -93,18 +196,61 @@ PE_EXPORT int pe_engine_load_by_name(const char *name)
 		return pe_engine_load(name);
 	}
 
+	const pe_engine_info_t *info = pe_manifest_find(engine_manifest(), name);
+	if (NULL == info && manifest_cached) {
+		/* the current directory is not checked, it may be new there */
+		pe_engine_rescan();
+		info = pe_manifest_find(engine_manifest(), name);
+	}
+	if (NULL != info)
+		return pe_engine_load(info->path);
+
+	/* not in the search directories, let the dynamic loader look */
 	char *libname = _compute_lib_path(name);
+	int res = pe_engine_load(libname);
+	free(libname);
+	return res;
+}
 
-	int i;
-	char path[PATH_MAX];
-	for (i = 0;
-	     i < (sizeof(_engine_search_path) / sizeof(_engine_search_path[0]));
-	     i++) {
-		sprintf(path, "%s%s", _engine_search_path[i], libname);
-		if (pe_engine_load(path) == 0)
-			return 0;
+/*
+ * (Re)create the event queue of eh and everything sized after it. The
+ * overflow table of QUEUE_COALESCE has the capacity of the queue, so a
+ * frame gets at most twice the capacity.
+ */
+static int engine_queue_setup(pe_engine_handle_t * eh, size_t capacity,
+			      pe_queue_policy_t policy)
+{
+	pe_queue_t *q;
+	int flags = PE_QUEUE_MPMC;
+
+	if (policy == QUEUE_BLOCK)
+		flags |= PE_QUEUE_BLOCKING;
+
+	q = pe_queue_new(capacity, sizeof(pe_event_t), flags);
+	if (NULL == q)
+		return PE_ERROR(-1, "could not create event queue");
+
+	if (eh->events != NULL) {
+		pe_queue_free(eh->events);
+		free(eh->batch);
+		free(eh->overflow);
+		pe_event_coalescer_free(&(eh->coalescer));
+		pe_event_coalescer_free(&(eh->overflow_index));
 	}
-	return -1;
+
+	capacity = pe_queue_capacity(q);
+	eh->events = q;
+	eh->queue_policy = policy;
+	eh->batch = malloc(2 * capacity * sizeof(pe_event_t));
+	eh->overflow = malloc(capacity * sizeof(pe_event_t));
+	eh->overflow_len = 0;
+	eh->overflowing = false;
+	if (NULL == eh->batch || NULL == eh->overflow
+	    || pe_event_coalescer_init(&(eh->coalescer), 2 * capacity)
+	    || pe_event_coalescer_init(&(eh->overflow_index), capacity))
+		return PE_ERROR(-1, "out of memory");
+
+	return 0;
 }
 
 PE_EXPORT int pe_engine_load(const char *path)
@@ -115,24 +261,30 @@ PE_EXPORT int pe_engine_load(const char *path)
 		PE_ABORT(pe_errno(), "Could not load symbol %s", n); \
 	}
 
-	if (engine_handles == NULL) {
-		// init engine_handles list
-		pe_list_init(engine_handles, pe_engine_handle_t *, 0);
-	}
-
 	void *handle = pe_dll_open(path);
 	if (handle == NULL) {
 		return PE_ERROR(pe_error_last()->code, (char *)path);
 	}
 
 	LOG_DEBUG("Loading engine from %s", path);
-	pe_engine_handle_t *eh = malloc(sizeof(pe_engine_handle_t));
-	eh->engine = malloc(sizeof(pe_engine_t));
+	pe_engine_handle_t *eh = calloc(1, sizeof(pe_engine_handle_t));
+	if (NULL == eh)
+		PE_ABORT(-1, "out of memory");
+
+	eh->engine = calloc(1, sizeof(pe_engine_t));
 
 	if (NULL == eh->engine)
 		PE_ABORT(-1, "out of memory");
 
 	eh->handle = handle;
+	eh->state = STATE_STOP;
+
+	SYM(eh, meta, "engine_meta");
+	const pe_engine_meta_t *meta = eh->meta();
+	eh->engine->name = (char *)meta->name;
+	eh->engine->version = (char *)meta->version;
+	eh->engine->script_language = (char *)meta->script_language;
+	eh->engine->script_suffix = (char *)meta->script_suffix;
 
 	SYM(eh, load, "engine_load");
 	eh->load(eh->engine);
@@ -147,8 +299,29 @@ PE_EXPORT int pe_engine_load(const char *path)
 
 	eh->engine->mutex = malloc(sizeof(pe_mutex_t));
 	pe_mutex_init(eh->engine->mutex);
+	pe_cond_init(&(eh->frame_ready));
+	pe_cond_init(&(eh->job_done));
+	pe_cond_init(&(eh->frame_done));
+	pe_mutex_init(&(eh->overflow_mutex));
+
+	if (engine_queue_setup(eh, queue_capacity, queue_policy))
+		PE_ABORT(-1, "out of memory");
+	pe_timer_wheel_init(&(eh->frame_timers), 0);
+	pe_timer_wheel_init(&(eh->ms_timers), pe_tstamp_mono_usec() / 1000);
+	if (pe_arena_init(&(eh->arena), 0))
+		PE_ABORT(-1, "out of memory");
+	eh->_frame.arena = &(eh->arena);
 
-	pe_list_add(engine_handles, pe_engine_handle_t *, eh);
+	if (pe_handle_vec_push(&engine_handles, eh))
+		PE_ABORT(-1, "out of memory");
+	if (NULL == pe_map_get(&engines_by_suffix, eh->engine->script_suffix)
+	    && pe_map_put(&engines_by_suffix, eh->engine->script_suffix, eh))
+		PE_ABORT(-1, "out of memory");
+	if (NULL == pe_map_get(&engines_by_name, eh->engine->name)
+	    && pe_map_put(&engines_by_name, eh->engine->name, eh))
+		PE_ABORT(-1, "out of memory");
+	if (pe_map_put_int(&engines_by_ptr, (uintptr_t) eh->engine, eh))
+		PE_ABORT(-1, "out of memory");
 
 	LOG_INFO
 	    ("Engine %s (%s) loaded. Script language: %s, Script suffix: %s",
@@ -183,6 +356,255 @@ PE_EXPORT int pe_engine_unload(pe_engine_handle_t * eh)
 	return 0;
 }
 
+static size_t stats_bucket(uint64_t usec)
+{
+	if (usec < 4)
+		return usec;
+
+	int msb = 63 - __builtin_clzll(usec);
+	size_t idx = (msb - 1) * 4 + ((usec >> (msb - 2)) & 3);
+
+	return idx < PE_STATS_BUCKETS ? idx : PE_STATS_BUCKETS - 1;
+}
+
+/* smallest duration that falls into bucket idx */
+static uint64_t stats_bucket_floor(size_t idx)
+{
+	if (idx < 4)
+		return idx;
+
+	return (uint64_t) (4 + idx % 4) << (idx / 4 - 1);
+}
+
+static void stats_record(pe_engine_stats_t * s, uint64_t usec,
+			 uint64_t period)
+{
+	s->frames++;
+	s->total += usec;
+	s->histogram[stats_bucket(usec)]++;
+
+	if (usec > s->max)
+		s->max = usec;
+
+	if (usec > period)
+		s->overruns++;
+}
+
+static void stats_dump(pe_engine_handle_t * eh)
+{
+	pe_engine_stats_t *s = &(eh->stats);
+	LOG_INFO("Engine %s: %" PRIu64 " frames, %" PRIu64 " skipped, %"
+		 PRIu64 " overruns, p50 %" PRIu64 "us, p99 %" PRIu64
+		 "us, max %" PRIu64 "us, mean %" PRIu64 "us, %" PRIu64
+		 " events, %" PRIu64 " coalesced, %" PRIu64 " dropped, %"
+		 PRIu64 " queued at most", eh->engine->name,
+		 s->frames, s->skipped, s->overruns,
+		 pe_engine_stats_percentile(s, 0.5),
+		 pe_engine_stats_percentile(s, 0.99), s->max,
+		 s->frames ? s->total / s->frames : 0, s->events,
+		 s->coalesced, s->dropped, s->queue_high);
+}
+
+/*
+ * Events are recorded with the frame they were delivered in, which is
+ * only known once a worker drained its queue. All engines get the same
+ * events, so only the engine running most often records them.
+ */
+static void record_batch(pe_engine_handle_t * eh, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		if (pe_record_append(recorder, eh->_frame.id, &(eh->batch[i])))
+			LOG_ERROR("could not record event");
+}
+
+/*
+ * Move all queued events into batch. Everything in the overflow table is
+ * newer than the queued events, and producers keep using the table until
+ * it has been drained, so the order of events is kept.
+ */
+static size_t engine_drain(pe_engine_handle_t * eh)
+{
+	size_t n, capacity = pe_queue_capacity(eh->events);
+
+	if (!__atomic_load_n(&(eh->overflowing), __ATOMIC_ACQUIRE))
+		return pe_queue_try_pop_batch(eh->events, eh->batch, capacity);
+
+	pe_mutex_lock(&(eh->overflow_mutex));
+	n = pe_queue_try_pop_batch(eh->events, eh->batch, capacity);
+	memcpy(eh->batch + n, eh->overflow,
+	       eh->overflow_len * sizeof(pe_event_t));
+	n += eh->overflow_len;
+	eh->overflow_len = 0;
+	__atomic_store_n(&(eh->overflowing), false, __ATOMIC_RELEASE);
+	pe_mutex_unlock(&(eh->overflow_mutex));
+
+	return n;
+}
+
+/*
+ * Each engine owns one worker thread for its whole lifetime. The worker
+ * holds the engine mutex while running a frame and releases it while it
+ * waits for the next one, so a failing trylock in engine_dispatch() still
+ * means "engine busy, skip this frame".
+ */
+static void *engine_thread_func(void *arg)
+{
+	pe_engine_handle_t *eh = arg;
+
+#ifndef _WIN32
+	/* SIGINT belongs to the main thread, which may wait for events */
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+#endif
+
+	pe_logger_thread_buffered(true);
+	pe_mutex_lock(eh->engine->mutex);
+	while (eh->state == STATE_RUNNING) {
+		if (eh->job != NULL) {
+			eh->job_result = eh->job(eh, eh->job_arg);
+			eh->job = NULL;
+			pe_logger_thread_flush();
+			pe_cond_signal(&(eh->job_done));
+			continue;
+		}
+
+		if (!eh->frame_pending) {
+			pe_cond_wait(&(eh->frame_ready), eh->engine->mutex);
+			continue;
+		}
+
+		eh->frame_pending = false;
+		__atomic_store_n(&(eh->in_frame), true, __ATOMIC_SEQ_CST);
+
+		/* the worker owns batch, so it stays valid for the frame */
+		size_t n = engine_drain(eh);
+		if (n > eh->stats.queue_high)
+			eh->stats.queue_high = n;
+		if (eh == record_source)
+			record_batch(eh, n);
+
+		uint64_t collapsed = 0;
+		if (coalesce)
+			n = pe_event_coalesce(&(eh->coalescer), eh->batch, n,
+					      &collapsed);
+
+		eh->_frame.events = eh->batch;
+		eh->_frame.events_len = n;
+		eh->_frame.events_coalesced = collapsed;
+		eh->stats.events += n;
+		/* producers count merges into the overflow table as well */
+		__atomic_add_fetch(&(eh->stats.coalesced), collapsed,
+				   __ATOMIC_RELAXED);
+
+		/* only frames and their timers allocate from the arena,
+		 * what jobs allocate outlives it */
+		pe_arena_set_current(&(eh->arena));
+		pe_timer_wheel_advance(&(eh->frame_timers), eh->_frame.id);
+		pe_timer_wheel_advance(&(eh->ms_timers),
+				       pe_tstamp_mono_usec() / 1000);
+
+		/* real time, even when simulating */
+		uint64_t start = pe_tstamp_mono_real_usec();
+		if (eh->frame(eh->_frame))
+			LOG_ERROR("frame failed");
+		pe_arena_set_current(NULL);
+		stats_record(&(eh->stats), pe_tstamp_mono_real_usec() - start,
+			     eh->_frame.period);
+		pe_arena_reset(&(eh->arena));
+		pe_logger_thread_flush();
+
+		/* event mode skipped us during the frame, ask for another */
+		__atomic_store_n(&(eh->in_frame), false, __ATOMIC_SEQ_CST);
+		if (__atomic_exchange_n(&(eh->redispatch), false,
+					__ATOMIC_SEQ_CST))
+			pe_engine_wakeup();
+		pe_cond_broadcast(&(eh->frame_done));
+
+		uint64_t next;
+		if (run_mode == RUN_EVENT
+		    && pe_timer_wheel_next(&(eh->ms_timers), &next) == 0)
+			pe_engine_wakeup_at(next * 1000);
+	}
+	pe_mutex_unlock(eh->engine->mutex);
+	pe_logger_thread_buffered(false);
+
+	return NULL;
+}
+
+static int engine_thread_start(pe_engine_handle_t * eh)
+{
+	if (eh->state == STATE_RUNNING)
+		return 0;
+
+	eh->state = STATE_RUNNING;
+	eh->frame_pending = false;
+	if (pe_thread_create(&(eh->thread), engine_thread_func, eh)) {
+		eh->state = STATE_STOP;
+		return PE_ERROR(pe_errno(), "could not create thread for %s",
+				eh->engine->name);
+	}
+
+	return 0;
+}
+
+static void engine_thread_stop(pe_engine_handle_t * eh)
+{
+	if (eh->state != STATE_RUNNING)
+		return;
+
+	pe_mutex_lock(eh->engine->mutex);
+	eh->state = STATE_STOP;
+	pe_cond_broadcast(&(eh->frame_ready));
+	pe_mutex_unlock(eh->engine->mutex);
+
+	pe_thread_join(eh->thread);
+}
+
+/*
+ * Interpreters like ruby must only be called from the thread that
+ * initialized them, so every call into an engine goes through its worker.
+ * Runs job on the worker and waits for the result.
+ */
+static int engine_call(pe_engine_handle_t * eh,
+		       int (*job) (pe_engine_handle_t *, const void *),
+		       const void *arg)
+{
+	int res;
+
+	if (eh->state != STATE_RUNNING)
+		return job(eh, arg);
+
+	pe_mutex_lock(eh->engine->mutex);
+	eh->job = job;
+	eh->job_arg = arg;
+	pe_cond_signal(&(eh->frame_ready));
+	while (eh->job != NULL)
+		pe_cond_wait(&(eh->job_done), eh->engine->mutex);
+	res = eh->job_result;
+	pe_mutex_unlock(eh->engine->mutex);
+
+	return res;
+}
+
+static int job_init(pe_engine_handle_t * eh, const void *arg)
+{
+	return eh->init();
+}
+
+static int job_load_script(pe_engine_handle_t * eh, const void *arg)
+{
+	return eh->load_script(arg);
+}
+
+static int job_unload(pe_engine_handle_t * eh, const void *arg)
+{
+	return pe_engine_unload(eh);
+}
+
 PE_EXPORT int pe_engine_init()
 {
 	CHECK_ENGINE_AVAIL;
@@ -193,80 +615,294 @@ PE_EXPORT int pe_engine_init()
 
 	int i;
 
-	pe_list_each(engine_handles, pe_engine_handle_t *, e, i)
-	    e->init();
+	pe_vec_each(pe_handle_vec, &engine_handles, e, i) {
+		if (engine_thread_start(e))
+			PE_ABORT(pe_errno(), "could not create thread");
+		if (engine_call(e, job_init, NULL))
+			return PE_ERROR(-1, "could not initialize engine %s",
+					e->engine->name);
+	}
 	pe_end;
 
 	return 0;
 }
 
-static void *engine_thread_func(void *arg)
+/*
+ * Hand the current frame to the worker of eh. If the engine is still busy
+ * the frame is skipped, unless wait is set: then the frame is handed over
+ * as soon as the worker is done with the previous one.
+ *
+ * In event mode nothing may ever wake the loop again, so a skipped engine
+ * gets a redispatch flag and wakes the loop when its frame is done. If
+ * the worker is not in a frame it only holds the mutex briefly, wait for
+ * it then. in_frame and redispatch are seq_cst, so either the worker sees
+ * the flag or we see that it left the frame.
+ */
+static void engine_dispatch(pe_engine_handle_t * eh, bool wait)
 {
-	pe_engine_handle_t *eh = arg;
-	if (eh->frame((eh->_frame))) {
-		LOG_ERROR("frame failed");
-		return NULL;
+	if (wait) {
+		pe_mutex_lock(eh->engine->mutex);
+		while (eh->frame_pending && eh->state == STATE_RUNNING)
+			pe_cond_wait(&(eh->frame_done), eh->engine->mutex);
+	} else if (pe_mutex_trylock(eh->engine->mutex)) {
+		if (run_mode != RUN_EVENT) {
+			eh->stats.skipped++;
+			return;
+		}
+
+		__atomic_store_n(&(eh->redispatch), true, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&(eh->in_frame), __ATOMIC_SEQ_CST)) {
+			eh->stats.skipped++;
+			return;
+		}
+		__atomic_store_n(&(eh->redispatch), false, __ATOMIC_SEQ_CST);
+		pe_mutex_lock(eh->engine->mutex);
 	}
+
+	/* the worker never picked up the previous frame */
+	if (eh->frame_pending)
+		eh->stats.skipped++;
+
+	eh->_frame = frame;
+	eh->_frame.period = frame_period * eh->divisor;
+	eh->frame_pending = true;
+	pe_cond_signal(&(eh->frame_ready));
 	pe_mutex_unlock(eh->engine->mutex);
 }
 
-PE_EXPORT int pe_engine_run()
+/*
+ * Wait for the deadline of the current frame. Deadlines are absolute, so
+ * the time spent dispatching does not add up to the frame period. If we
+ * are late by more than a whole period, the overrun policy decides
+ * whether the missed frames still run or are dropped.
+ */
+static void frame_clock_wait()
 {
-	CHECK_ENGINE_AVAIL;
-	current_state = STATE_RUNNING;
+	uint64_t now = pe_tstamp_mono_usec();
+
+	if (now < frame.scheduled) {
+		pe_sleep_until(frame.scheduled);
+		now = pe_tstamp_mono_usec();
+	} else if (overrun_policy == OVERRUN_DROP
+		   && now - frame.scheduled >= frame_period) {
+		uint64_t missed = (now - frame.scheduled) / frame_period;
+		frame.id += missed;
+		frame.scheduled += missed * frame_period;
+		frames_dropped += missed;
+	}
 
-	for (frame.id = 0; current_state == STATE_RUNNING; frame.id++) {
-		int i;
-		pe_list_each(engine_handles, pe_engine_handle_t *, eh, i) {
+	frame.started = now;
+}
 
-			if (pe_mutex_trylock(eh->engine->mutex)) {
-				continue;
+/* wait until the worker of eh is done with its pending frame */
+static void engine_wait_idle(pe_engine_handle_t * eh)
+{
+	pe_mutex_lock(eh->engine->mutex);
+	while (eh->frame_pending && eh->state == STATE_RUNNING)
+		pe_cond_wait(&(eh->frame_done), eh->engine->mutex);
+	pe_mutex_unlock(eh->engine->mutex);
+}
+
+static int queue_event(const pe_event_t * ev, bool may_block);
+
+/*
+ * Replays and simulations run in lockstep: a frame only starts once all
+ * engines finished the previous one, so no frame is skipped, queues are
+ * drained and the clock does not move while an engine is still running.
+ * That way every run gets the same batches and timers.
+ */
+static bool lockstep()
+{
+	return replayer != NULL || simulate_frames > 0;
+}
+
+static void run_fixed()
+{
+	const pe_record_entry_t *e;
+	uint64_t events = 0, start;
+	int i;
+
+	frame.id = 0;
+	frame.scheduled = pe_tstamp_mono_usec();
+	start = pe_tstamp_mono_real_usec();
+	while (current_state == STATE_RUNNING) {
+		if (lockstep()) {
+			pe_vec_each(pe_handle_vec, &engine_handles, eh,
+				     i) {
+				engine_wait_idle(eh);
 			}
+			pe_end;
+
+			if (simulate_frames > 0 && frame.id >= simulate_frames)
+				break;
+			if (replayer != NULL && pe_record_eof(replayer))
+				break;
+		}
+
+		frame_clock_wait();
 
-			if (frame.id > 0)
-				pe_thread_join(eh->thread);
+		/* dropped frames may have jumped past the end */
+		if (simulate_frames > 0 && frame.id >= simulate_frames)
+			break;
 
-			eh->_frame = frame;
-			if (pe_thread_create
-			    (&(eh->thread), engine_thread_func, eh)) {
-				PE_ABORT(pe_errno(), "could not create thread");
+		if (replayer != NULL) {
+			while ((e = pe_record_next(replayer, frame.id)) != NULL) {
+				/* the workers are idle, don't wait for them */
+				queue_event(&(e->event), false);
+				events++;
 			}
+		}
+
+		pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+			/* dropped frames may have jumped over this engine's
+			 * tick, so don't test for frame.id % divisor == 0 */
+			if (frame.id < eh->next_tick)
+				continue;
 
+			eh->next_tick =
+			    (frame.id / eh->divisor + 1) * eh->divisor;
+			engine_dispatch(eh, lockstep());
 		}
 		pe_end;
-		pe_sleep(PIOE_FRAME_RESOLUTION_MS);
+
 		frame.id++;
+		frame.scheduled += frame_period;
 	}
 
-	return 0;
+	if (frames_dropped > 0)
+		LOG_WARN("%" PRIu64 " frames dropped due to overruns",
+			 frames_dropped);
+
+	if (lockstep()) {
+		uint64_t elapsed = pe_tstamp_mono_real_usec() - start;
+		if (replayer != NULL)
+			LOG_INFO("Replayed %" PRIu64 " events", events);
+		LOG_INFO("Ran %" PRIu64 " frames in %.3f s, %.1f frames/s",
+			 frame.id, elapsed / 1000000.0,
+			 elapsed ? frame.id * 1000000.0 / elapsed : 0.0);
+		current_state = STATE_STOP;
+	}
 }
 
-PE_EXPORT int pe_engine_load_script(const char *file)
+#ifdef __linux__
+static int event_loop_init()
 {
-	CHECK_ENGINE_AVAIL;
+	struct epoll_event ev;
 
-	if (access(file, F_OK) == -1) {
-		return PE_ERROR(-1, "No such file or directory");
-	}
+	if (epoll_fd >= 0)
+		return 0;
 
-	const char *suffix = strrchr(file, '.') + 1;
-	pe_engine_handle_t *eh = NULL;
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (epoll_fd < 0 || event_fd < 0 || timer_fd < 0)
+		return PE_ERROR(pe_errno(), "could not create event loop: %s",
+				pe_error_str(pe_errno()));
 
-	int i;
-	pe_list_each(engine_handles, pe_engine_handle_t *, e, i) {
-		if (NULL == e)
+	pe_mutex_init(&wakeup_mutex);
+
+	ev.events = EPOLLIN;
+	ev.data.fd = event_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event_fd, &ev);
+	ev.data.fd = timer_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+
+	return 0;
+}
+
+/*
+ * Tickless mode: block until one of the event sources fires, then run a
+ * single frame on all engines. Per-engine rates do not apply here.
+ */
+static void run_event()
+{
+	struct epoll_event events[16];
+	uint64_t buf;
+	int i, n;
+
+	frame.id = 0;
+	while (current_state == STATE_RUNNING) {
+		n = epoll_wait(epoll_fd, events, ARRAY_SIZE(events), -1);
+		if (n < 0) {
+			if (errno != EINTR)
+				PE_ABORT(pe_errno(), "epoll_wait failed");
 			continue;
+		}
 
-		if (NULL == e->engine)
-			PE_ABORT(-1, "e->engine is NULL");
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == event_fd) {
+				read(event_fd, &buf, sizeof(buf));
+			} else if (events[i].data.fd == timer_fd) {
+				read(timer_fd, &buf, sizeof(buf));
+				pe_mutex_lock(&wakeup_mutex);
+				wakeup_deadline = UINT64_MAX;
+				pe_mutex_unlock(&wakeup_mutex);
+			}
+		}
 
-		if (strcmp(suffix, e->engine->script_suffix) == 0) {
-			eh = e;
-			break;
+		frame.scheduled = frame.started = pe_tstamp_mono_usec();
+		pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+			engine_dispatch(eh, false);
 		}
+		pe_end;
+		frame.id++;
+	}
+}
+#endif
+
+PE_EXPORT int pe_engine_run()
+{
+	CHECK_ENGINE_AVAIL;
+	current_state = STATE_RUNNING;
+
+	frame_period = 1000000 / frame_rate;
+
+	int i;
+	pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+		unsigned int rate = eh->engine->frame_rate;
+		if ((run_mode == RUN_EVENT && !lockstep()) || rate == 0
+		    || rate >= frame_rate)
+			eh->divisor = 1;
+		else
+			eh->divisor = (frame_rate + rate / 2) / rate;
+		eh->next_tick = 0;
+
+		LOG_DEBUG("Engine %s runs every %" PRIu64 " frame(s) (%.2f hz)",
+			  eh->engine->name, eh->divisor,
+			  (double)frame_rate / eh->divisor);
+
+		if (recorder != NULL && (record_source == NULL
+					 || eh->divisor < record_source->divisor))
+			record_source = eh;
+
+		if (engine_thread_start(eh))
+			PE_ABORT(pe_errno(), "could not create thread");
 	}
 	pe_end;
 
+#ifdef __linux__
+	if (run_mode == RUN_EVENT && !lockstep()) {
+		if (event_loop_init())
+			PE_ABORT(pe_errno(), "could not start event mode");
+		run_event();
+	} else
+#endif
+		run_fixed();
+
+	return 0;
+}
+
+PE_EXPORT int pe_engine_load_script(const char *file)
+{
+	CHECK_ENGINE_AVAIL;
+
+	if (access(file, F_OK) == -1) {
+		return PE_ERROR(-1, "No such file or directory");
+	}
+
+	const char *suffix = strrchr(file, '.') + 1;
+	pe_engine_handle_t *eh = pe_map_get(&engines_by_suffix, suffix);
+
 	if (NULL == eh)
 		return -1;
 
@@ -294,7 +930,7 @@ PE_EXPORT int pe_engine_load_script(const char *file)
 
 	// ADD PREPROCESSOR HERE
 
-	if (eh->load_script(fbuf))
+	if (engine_call(eh, job_load_script, fbuf))
 		PE_ABORT(pe_errno(), (char *)file);
 
 	free(fbuf);
@@ -305,11 +941,42 @@ PE_EXPORT int pe_engine_quit()
 {
 	int i;
 	current_state = STATE_STOP;
-	pe_list_each(engine_handles, pe_engine_handle_t *, eh, i) {
-		pe_thread_cancel(eh->thread);
-		pe_engine_unload(eh);
+
+	if (0 == pe_vec_count(&engine_handles)) {
+		pe_logger_flush();
+		return 0;
+	}
+
+	pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+		if (eh->handle == NULL)
+			continue;
+
+		/* wait for a running frame before reading its stats */
+		pe_mutex_lock(eh->engine->mutex);
+		if (eh->stats.frames > 0 || eh->stats.skipped > 0)
+			stats_dump(eh);
+		pe_mutex_unlock(eh->engine->mutex);
+
+		engine_call(eh, job_unload, NULL);
+		engine_thread_stop(eh);
+		eh->handle = NULL;
 	}
 	pe_end;
+
+	if (recorder != NULL) {
+		LOG_INFO("Recorded %" PRIu64 " events",
+			 recorder->header->count);
+		pe_record_close(recorder);
+		recorder = NULL;
+		record_source = NULL;
+	}
+	if (replayer != NULL) {
+		pe_record_close(replayer);
+		replayer = NULL;
+	}
+
+	pe_pool_stats_dump();
+	pe_logger_flush();
 	return 0;
 }
 
@@ -328,18 +995,390 @@ PE_EXPORT uint64_t pe_engine_frame_id()
 	return frame.id;
 }
 
+PE_EXPORT void pe_engine_set_overrun_policy(pe_overrun_policy_t policy)
+{
+	overrun_policy = policy;
+}
+
+static void engine_dropped(pe_engine_handle_t * eh)
+{
+	if (__atomic_fetch_add(&(eh->stats.dropped), 1, __ATOMIC_RELAXED) == 0)
+		LOG_WARN("Event queue of %s is full, dropping events",
+			 eh->engine->name);
+}
+
+/* merge ev into the overflow table of a QUEUE_COALESCE engine */
+static int engine_overflow(pe_engine_handle_t * eh, const pe_event_t * ev)
+{
+	int res;
+
+	pe_mutex_lock(&(eh->overflow_mutex));
+	if (!eh->overflowing) {
+		pe_event_coalescer_reset(&(eh->overflow_index));
+		__atomic_store_n(&(eh->overflowing), true, __ATOMIC_RELEASE);
+	}
+	res = pe_event_coalesce_one(&(eh->overflow_index), eh->overflow,
+				    &(eh->overflow_len),
+				    pe_queue_capacity(eh->events), ev);
+	pe_mutex_unlock(&(eh->overflow_mutex));
+
+	if (res == 1)
+		__atomic_add_fetch(&(eh->stats.coalesced), 1,
+				   __ATOMIC_RELAXED);
+	else if (res < 0)
+		engine_dropped(eh);
+
+	return res < 0 ? -1 : 0;
+}
+
+/* queue ev for eh according to its policy, -1 if an event was dropped */
+static int engine_enqueue(pe_engine_handle_t * eh, const pe_event_t * ev,
+			  bool may_block)
+{
+	pe_event_t oldest;
+	int res = 0;
+
+	switch (eh->queue_policy) {
+	case QUEUE_BLOCK:
+		if (may_block)
+			return pe_queue_push(eh->events, ev);
+		/* the queue is blocking, so only try */
+		if (pe_queue_try_push(eh->events, ev) == 0)
+			return 0;
+		engine_dropped(eh);
+		return -1;
+	case QUEUE_DROP_OLDEST:
+		while (pe_queue_push(eh->events, ev)) {
+			if (pe_queue_try_pop_batch(eh->events, &oldest, 1)) {
+				engine_dropped(eh);
+				res = -1;
+			}
+		}
+		return res;
+	case QUEUE_COALESCE:
+		if (!__atomic_load_n(&(eh->overflowing), __ATOMIC_ACQUIRE)
+		    && pe_queue_push(eh->events, ev) == 0)
+			return 0;
+		return engine_overflow(eh, ev);
+	default:
+		break;
+	}
+
+	if (pe_queue_push(eh->events, ev) == 0)
+		return 0;
+
+	engine_dropped(eh);
+	return -1;
+}
+
+/* hand ev to every engine */
+static int queue_event(const pe_event_t * ev, bool may_block)
+{
+	int i, res = 0;
+
+	pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+		if (engine_enqueue(eh, ev, may_block))
+			res = -1;
+	}
+	pe_end;
+
+	return res;
+}
+
+PE_EXPORT int pe_engine_push_event(pe_event_t * ev)
+{
+	int res;
+
+	if (0 == pe_vec_count(&engine_handles))
+		return PE_ERROR(-1, "NO ENGINE AVAILABLE");
+
+	/* live input is ignored while replaying */
+	if (replayer != NULL)
+		return 0;
+
+	if (ev->time == 0)
+		ev->time = pe_tstamp_mono_usec();
+
+	res = queue_event(ev, true);
+
+	if (run_mode == RUN_EVENT)
+		pe_engine_wakeup();
+
+	return res;
+}
+
+PE_EXPORT int pe_engine_simulate(uint64_t frames)
+{
+	if (frames == 0)
+		return PE_ERROR(-1, "nothing to simulate");
+
+	simulate_frames = frames;
+	pe_clock_set_virtual(true);
+	return 0;
+}
+
+PE_EXPORT int pe_engine_record(const char *path)
+{
+	if (recorder != NULL)
+		return PE_ERROR(-1, "already recording");
+
+	if (pe_record_create(&recording, path, frame_rate))
+		return -1;
+
+	recorder = &recording;
+	LOG_INFO("Recording events to %s", path);
+	return 0;
+}
+
+PE_EXPORT int pe_engine_replay(const char *path, pe_replay_speed_t speed)
+{
+	if (replayer != NULL)
+		return PE_ERROR(-1, "already replaying");
+
+	if (pe_record_open(&replay, path))
+		return -1;
+
+	if (pe_engine_set_frame_rate(replay.header->frame_rate)) {
+		pe_record_close(&replay);
+		return PE_ERROR(-1, "invalid frame rate in %s", path);
+	}
+
+	replayer = &replay;
+	if (speed == REPLAY_FAST)
+		pe_clock_set_virtual(true);
+	LOG_INFO("Replaying %" PRIu64 " events at %u hz from %s",
+		 replay.header->count, frame_rate, path);
+	return 0;
+}
+
+PE_EXPORT int pe_engine_timer_add(pe_engine_t * e, pe_timer_t * timer,
+				  pe_timer_unit_t unit, uint64_t n)
+{
+	CHECK_ENGINE_AVAIL;
+
+	pe_engine_handle_t *eh = pe_map_get_int(&engines_by_ptr, (uintptr_t) e);
+	if (NULL == eh)
+		return PE_ERROR(-1, "Unknown engine");
+
+	if (unit == TIMER_FRAMES) {
+		pe_timer_schedule(&(eh->frame_timers), timer,
+				  eh->frame_timers.now + n);
+	} else {
+		/* the wheel only advances on frames, count from now */
+		pe_timer_schedule(&(eh->ms_timers), timer,
+				  pe_tstamp_mono_usec() / 1000 + n);
+		if (run_mode == RUN_EVENT)
+			pe_engine_wakeup_at(timer->expires * 1000);
+	}
+	return 0;
+}
+
+PE_EXPORT int pe_engine_set_queue(const char *name, size_t capacity,
+				  pe_queue_policy_t policy)
+{
+	pe_engine_handle_t *named;
+	int i;
+
+	if (current_state == STATE_RUNNING)
+		return PE_ERROR(-1, "can't change event queues while running");
+
+	if (capacity == 0)
+		return PE_ERROR(-1, "invalid queue capacity");
+
+	if (NULL == name) {
+		queue_capacity = capacity;
+		queue_policy = policy;
+	}
+
+	if (NULL != name) {
+		named = pe_map_get(&engines_by_name, name);
+		if (NULL == named)
+			return PE_ERROR(-1, "No such engine: %s", name);
+		return engine_queue_setup(named, capacity, policy);
+	}
+
+	pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+		if (engine_queue_setup(eh, capacity, policy))
+			return -1;
+	}
+	pe_end;
+
+	return 0;
+}
+
+PE_EXPORT void pe_engine_set_coalesce(bool enable)
+{
+	coalesce = enable;
+}
+
+PE_EXPORT int pe_engine_set_run_mode(pe_run_mode_t mode)
+{
+#ifndef __linux__
+	if (mode == RUN_EVENT)
+		return PE_ERROR(-1, "event mode is only supported on linux");
+#endif
+#ifdef __linux__
+	if (mode == RUN_EVENT && event_loop_init())
+		return -1;
+#endif
+	run_mode = mode;
+	return 0;
+}
+
+PE_EXPORT int pe_engine_wakeup()
+{
+#ifdef __linux__
+	uint64_t one = 1;
+
+	if (event_fd < 0)
+		return 0;
+
+	if (write(event_fd, &one, sizeof(one)) != sizeof(one)
+	    && errno != EAGAIN)
+		return PE_ERROR(pe_errno(), "could not wake up frame loop");
+#endif
+	return 0;
+}
+
+PE_EXPORT int pe_engine_wakeup_at(uint64_t deadline)
+{
+#ifdef __linux__
+	struct itimerspec its = { {0, 0}, {0, 0} };
+
+	if (timer_fd < 0)
+		return 0;
+
+	pe_mutex_lock(&wakeup_mutex);
+	if (deadline < wakeup_deadline) {
+		wakeup_deadline = deadline;
+		/* zero would disarm the timer */
+		if (deadline == 0)
+			deadline = 1;
+		its.it_value.tv_sec = deadline / 1000000ULL;
+		its.it_value.tv_nsec = (deadline % 1000000ULL) * 1000;
+		timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	}
+	pe_mutex_unlock(&wakeup_mutex);
+#endif
+	return 0;
+}
+
+PE_EXPORT int pe_engine_watch_fd(int fd)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if (event_loop_init())
+		return -1;
+
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.fd = fd;
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev))
+		return PE_ERROR(pe_errno(), "could not watch fd %i", fd);
+
+	return 0;
+#else
+	return PE_ERROR(-1, "event mode is only supported on linux");
+#endif
+}
+
+PE_EXPORT int pe_engine_set_frame_rate(unsigned int hz)
+{
+	if (hz == 0 || hz > 1000000)
+		return PE_ERROR(-1, "Invalid frame rate: %u", hz);
+
+	frame_rate = hz;
+	return 0;
+}
+
+PE_EXPORT unsigned int pe_engine_frame_rate()
+{
+	return frame_rate;
+}
+
+PE_EXPORT int pe_engine_set_engine_rate(const char *name, unsigned int hz)
+{
+	CHECK_ENGINE_AVAIL;
+
+	pe_engine_handle_t *eh = pe_map_get(&engines_by_name, name);
+	if (NULL == eh)
+		return PE_ERROR(-1, "No such engine: %s", name);
+
+	eh->engine->frame_rate = hz;
+	return 0;
+}
+
+PE_EXPORT int pe_engine_stats(pe_engine_t * e, pe_engine_stats_t * out)
+{
+	CHECK_ENGINE_AVAIL;
+
+	pe_engine_handle_t *eh = pe_map_get_int(&engines_by_ptr, (uintptr_t) e);
+	if (NULL == eh)
+		return PE_ERROR(-1, "Unknown engine");
+
+	*out = eh->stats;
+	return 0;
+}
+
+PE_EXPORT uint64_t pe_engine_stats_percentile(const pe_engine_stats_t * s,
+					      double p)
+{
+	if (s->frames == 0)
+		return 0;
+
+	uint64_t rank = (uint64_t) (p * s->frames);
+	uint64_t seen = 0;
+	size_t i;
+
+	if (rank >= s->frames)
+		rank = s->frames - 1;
+
+	for (i = 0; i < PE_STATS_BUCKETS; i++) {
+		seen += s->histogram[i];
+		if (seen > rank)
+			break;
+	}
+
+	/* report the upper bound of the bucket, but never more than max */
+	if (i + 1 >= PE_STATS_BUCKETS || stats_bucket_floor(i + 1) > s->max)
+		return s->max;
+
+	return stats_bucket_floor(i + 1) - 1;
+}
+
+PE_EXPORT void pe_engine_stats_dump()
+{
+	if (0 == pe_vec_count(&engine_handles))
+		return;
+
+	int i;
+	pe_vec_each(pe_handle_vec, &engine_handles, eh, i) {
+		stats_dump(eh);
+	}
+	pe_end;
+	pe_pool_stats_dump();
+}
+
 PE_EXPORT pe_class_t *pe_engine_define_class(pe_plugin_t * plugin,
 					     const char *name,
 					     pe_class_t * parent)
 {
 	CHECK_ENGINE_AVAIL;
 	LOG_DEBUG("Defining class for plugin %s", plugin->name);
+	if (NULL != pe_map_get(&(plugin->classes), name)) {
+		PE_ERROR(-1, "Class %s is already defined", name);
+		return NULL;
+	}
+
 	pe_class_t *c = malloc(sizeof(pe_class_t));
-	c->name = strdup(name);
-	pe_list_t *im = c->instance_methods;
-	pe_list_init(c->instance_methods, pe_method_t *, 0);
-	pe_list_init(c->class_methods, pe_method_t *, 0);
-	pe_list_init(c->instances, pe_instance_t *, 0);
+	c->name = pe_symbol(name);
+	c->parent = parent;
+	pe_method_vec_init(&(c->instance_methods));
+	pe_method_vec_init(&(c->class_methods));
+	pe_instance_vec_init(&(c->instances));
+	/* plugins only see a const pe_plugin_t, the class table is ours */
+	if (pe_map_put((pe_map_t *) & (plugin->classes), name, c))
+		PE_ABORT(-1, "out of memory");
 	return c;
 }
 
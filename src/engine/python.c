@@ -37,15 +37,79 @@ static pe_logger_t logger;
 static int python_code(const char *fmt, ...);
 static int handle_exception();
 
+/* callable given to pioe.on_frame */
+static PyObject *on_frame = NULL;
+
+static PyObject *m_stats(PyObject * self, PyObject * args);
+static PyObject *m_on_frame(PyObject * self, PyObject * args);
+static PyObject *m_after(PyObject * self, PyObject * args);
+static PyObject *m_after_frames(PyObject * self, PyObject * args);
+
+static PyMethodDef pioe_methods[] = {
+	{"stats", m_stats, METH_NOARGS, "Frame statistics of this engine"},
+	{"on_frame", m_on_frame, METH_VARARGS,
+	 "Call f(frame_id, events) once per frame"},
+	{"after", m_after, METH_VARARGS,
+	 "Call f() once after ms milliseconds, returns a Timer"},
+	{"after_frames", m_after_frames, METH_VARARGS,
+	 "Call f() once after n frames, returns a Timer"},
+	{NULL, NULL, 0, NULL}
+};
+
+/* pioe.Timer, holds a reference to itself while it is scheduled */
+typedef struct {
+	PyObject_HEAD pe_timer_t timer;
+	PyObject *func;
+} timer_object;
+
+static PyObject *timer_cancel(PyObject * self, PyObject * args);
+static PyObject *timer_pending(PyObject * self, PyObject * args);
+static void timer_dealloc(PyObject * self);
+
+static PyMethodDef timer_methods[] = {
+	{"cancel", timer_cancel, METH_NOARGS,
+	 "Unschedule the timer, returns True if it was pending"},
+	{"pending", timer_pending, METH_NOARGS,
+	 "True if the timer has not fired yet"},
+	{NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject timer_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	    .tp_name = "pioe.Timer",
+	.tp_basicsize = sizeof(timer_object),
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "Timer returned by pioe.after and pioe.after_frames",
+	.tp_dealloc = timer_dealloc,
+	.tp_methods = timer_methods,
+};
+
+static struct PyModuleDef pioe_module = {
+	PyModuleDef_HEAD_INIT, "pioe", NULL, -1, pioe_methods
+};
+
+static PyObject *pioe_module_init()
+{
+	if (PyType_Ready(&timer_type) < 0)
+		return NULL;
+
+	return PyModule_Create(&pioe_module);
+}
+
+static const pe_engine_meta_t meta = {
+	"Python", "0.0.1", "Python", "py"
+};
+
+PE_EXPORT const pe_engine_meta_t *engine_meta()
+{
+	return &meta;
+}
+
 PE_EXPORT int engine_load(pe_engine_t * p)
 {
 	pe_logger_new(&logger, "python-engine");
 	LOG_DEBUG("Loading");
 	engine = p;
-	engine->name = "Python";
-	engine->version = "0.0.1";
-	engine->script_language = "Python";
-	engine->script_suffix = "py";
 	return 0;
 }
 
@@ -58,9 +122,14 @@ PE_EXPORT int engine_unload()
 PE_EXPORT int engine_init()
 {
 	LOG_DEBUG("Initializing");
-	Py_SetProgramName((wchar_t *) "PIOE");
+	Py_SetProgramName(L"PIOE");
+	PyImport_AppendInittab("pioe", &pioe_module_init);
 	Py_Initialize();
 
+	/* frames run on the engine's worker thread, release the GIL here and
+	 * take it with PyGILState_Ensure() wherever python is called */
+	PyEval_SaveThread();
+
 	return 0;
 }
 
@@ -69,7 +138,33 @@ PE_EXPORT int engine_frame(pe_frame_t frame)
 	if ((frame.id % 500) == 0) {
 		LOG_DEBUG("500st!");
 	}
-	return 0;
+
+	if (NULL == on_frame)
+		return 0;
+
+	PyGILState_STATE gil = PyGILState_Ensure();
+
+	/* hand the whole batch to the script in a single call */
+	PyObject *events = PyList_New(frame.events_len);
+	size_t i;
+	for (i = 0; i < frame.events_len; i++) {
+		const pe_event_t *ev = &frame.events[i];
+		PyList_SET_ITEM(events, i,
+				Py_BuildValue("(IIIiK)", ev->device, ev->type,
+					      ev->code, ev->value,
+					      (unsigned long long)ev->time));
+	}
+
+	PyObject *res = PyObject_CallFunction(on_frame, "KO",
+					      (unsigned long long)frame.id,
+					      events);
+	Py_DECREF(events);
+	if (NULL == res)
+		PyErr_Print();
+	Py_XDECREF(res);
+
+	PyGILState_Release(gil);
+	return res == NULL ? -1 : 0;
 }
 
 PE_EXPORT int engine_start()
@@ -89,13 +184,17 @@ PE_EXPORT int engine_stop()
 PE_EXPORT int engine_quit()
 {
 	LOG_DEBUG("Quit");
+	PyGILState_Ensure();
 	Py_Finalize();
 	return 0;
 }
 
 PE_EXPORT int engine_load_script(const char *code)
 {
-	return 0;
+	PyGILState_STATE gil = PyGILState_Ensure();
+	int res = PyRun_SimpleString(code);
+	PyGILState_Release(gil);
+	return res;
 }
 
 PE_EXPORT int engine_execute_code(const char *code)
@@ -188,10 +287,130 @@ static int python_code(const char *fmt, ...)
 	LOG_DEBUG(sbuf);
 
 	int error = 0;
+	PyGILState_STATE gil = PyGILState_Ensure();
 	PyRun_SimpleString(sbuf);
+	PyGILState_Release(gil);
 
 	if (error) {
 		return handle_exception();
 	}
 	return 0;
 }
+
+static PyObject *m_stats(PyObject * self, PyObject * args)
+{
+	pe_engine_stats_t s;
+	if (pe_engine_stats(engine, &s))
+		Py_RETURN_NONE;
+
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K,s:K}",
+			     "frames", s.frames,
+			     "skipped", s.skipped,
+			     "overruns", s.overruns,
+			     "max", s.max,
+			     "mean", s.frames ? s.total / s.frames : 0,
+			     "p50", pe_engine_stats_percentile(&s, 0.5),
+			     "p99", pe_engine_stats_percentile(&s, 0.99),
+			     "events", s.events,
+			     "coalesced", s.coalesced,
+			     "dropped", s.dropped,
+			     "queue_high", s.queue_high);
+}
+
+static PyObject *m_on_frame(PyObject * self, PyObject * args)
+{
+	PyObject *f;
+	if (!PyArg_ParseTuple(args, "O", &f))
+		return NULL;
+
+	if (!PyCallable_Check(f)) {
+		PyErr_SetString(PyExc_TypeError, "on_frame needs a callable");
+		return NULL;
+	}
+
+	Py_INCREF(f);
+	Py_XDECREF(on_frame);
+	on_frame = f;
+	Py_RETURN_NONE;
+}
+
+static void timer_fire(pe_timer_t * timer)
+{
+	timer_object *t = timer->data;
+
+	PyGILState_STATE gil = PyGILState_Ensure();
+	PyObject *res = PyObject_CallNoArgs(t->func);
+	if (NULL == res)
+		PyErr_Print();
+	Py_XDECREF(res);
+	/* drop the reference held while scheduled */
+	Py_DECREF(t);
+	PyGILState_Release(gil);
+}
+
+static PyObject *schedule(pe_timer_unit_t unit, PyObject * args)
+{
+	unsigned long long n;
+	PyObject *f;
+	if (!PyArg_ParseTuple(args, "KO", &n, &f))
+		return NULL;
+
+	if (!PyCallable_Check(f)) {
+		PyErr_SetString(PyExc_TypeError, "timer needs a callable");
+		return NULL;
+	}
+
+	timer_object *t = PyObject_New(timer_object, &timer_type);
+	if (NULL == t)
+		return NULL;
+
+	Py_INCREF(f);
+	t->func = f;
+	pe_timer_init(&(t->timer), timer_fire, t);
+
+	if (pe_engine_timer_add(engine, &(t->timer), unit, n)) {
+		Py_DECREF(t);
+		PyErr_SetString(PyExc_RuntimeError, "could not schedule timer");
+		return NULL;
+	}
+
+	Py_INCREF(t);
+	return (PyObject *) t;
+}
+
+static PyObject *m_after(PyObject * self, PyObject * args)
+{
+	return schedule(TIMER_MS, args);
+}
+
+static PyObject *m_after_frames(PyObject * self, PyObject * args)
+{
+	return schedule(TIMER_FRAMES, args);
+}
+
+static PyObject *timer_cancel(PyObject * self, PyObject * args)
+{
+	timer_object *t = (timer_object *) self;
+
+	if (!pe_timer_cancel(&(t->timer)))
+		Py_RETURN_FALSE;
+
+	Py_DECREF(t);
+	Py_RETURN_TRUE;
+}
+
+static PyObject *timer_pending(PyObject * self, PyObject * args)
+{
+	timer_object *t = (timer_object *) self;
+
+	return PyBool_FromLong(pe_timer_pending(&(t->timer)));
+}
+
+static void timer_dealloc(PyObject * self)
+{
+	timer_object *t = (timer_object *) self;
+
+	pe_timer_cancel(&(t->timer));
+	Py_XDECREF(t->func);
+	PyObject_Free(self);
+}
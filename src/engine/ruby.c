@@ -42,25 +42,87 @@ static VALUE V_PIOE;
 
 static VALUE V_Frame;
 
+static VALUE V_Event;
+
+static VALUE V_Timer;
+
+/* block given to PIOE.on_frame */
+static VALUE on_frame = Qnil;
+
+/* scheduled PIOE::Timer objects, keeps them from being collected */
+static VALUE timers = Qnil;
+
+typedef struct {
+	pe_timer_t timer;
+	VALUE block;
+	VALUE self;
+} rb_timer_t;
+
+static void timer_mark(void *p);
+static void timer_free(void *p);
+
+/* timer records are allocated on every PIOE.after, keep them pooled */
+static pe_pool_t timer_pool = PE_POOL_INIT("ruby timers", sizeof(rb_timer_t));
+
+static const rb_data_type_t timer_type = {
+	"PIOE::Timer", {timer_mark, timer_free, NULL,}, NULL, NULL, 0
+};
+
 static VALUE m_frame_id(int argc, const VALUE * argv, VALUE self);
+static VALUE m_stats(VALUE self);
+static VALUE m_on_frame(VALUE self);
+static VALUE m_after(int argc, const VALUE * argv, VALUE self);
+static VALUE m_after_frames(int argc, const VALUE * argv, VALUE self);
+static VALUE m_timer_cancel(int argc, const VALUE * argv, VALUE self);
+static VALUE m_timer_pending(int argc, const VALUE * argv, VALUE self);
 
 static VALUE v_method_callback(int argc, const VALUE * argv, VALUE self);
 
+/* method ids and hash keys, interned once in engine_init */
+static ID id_message, id_class, id_to_s, id_backtrace;
+
+enum {
+	STAT_FRAMES,
+	STAT_SKIPPED,
+	STAT_OVERRUNS,
+	STAT_MAX,
+	STAT_MEAN,
+	STAT_P50,
+	STAT_P99,
+	STAT_EVENTS,
+	STAT_COALESCED,
+	STAT_DROPPED,
+	STAT_QUEUE_HIGH,
+	STAT_KEYS
+};
+
+static const char *stat_names[STAT_KEYS] = {
+	"frames", "skipped", "overruns", "max", "mean", "p50", "p99",
+	"events", "coalesced", "dropped", "queue_high",
+};
+
+static VALUE stat_keys[STAT_KEYS];
+
 static VALUE v_method_callback(int argc, const VALUE * argv, VALUE self)
 {
 
 	return Qnil;
 }
 
+static const pe_engine_meta_t meta = {
+	"Ruby", "0.1.0", "ruby", "rb"
+};
+
+PE_EXPORT const pe_engine_meta_t *engine_meta()
+{
+	return &meta;
+}
+
 PE_EXPORT int engine_load(pe_engine_t * p)
 {
 	pe_logger_new(&logger, "ruby-engine");
 	LOG_DEBUG("Loading...");
 	engine = p;
-	engine->name = "Ruby";
-	engine->version = "0.1.0";
-	engine->script_language = "ruby";
-	engine->script_suffix = "rb";
 
 	return 0;
 }
@@ -84,10 +146,40 @@ PE_EXPORT int engine_init()
 
 	rb_define_singleton_method(V_PIOE, "method_callback", v_method_callback,
 				   3);
+	rb_define_singleton_method(V_PIOE, "stats", m_stats, 0);
+	rb_define_singleton_method(V_PIOE, "on_frame", m_on_frame, 0);
+	rb_define_singleton_method(V_PIOE, "after", m_after, -1);
+	rb_define_singleton_method(V_PIOE, "after_frames", m_after_frames, -1);
+
+	V_Event = rb_struct_define_under(V_PIOE, "Event", "device", "type",
+					 "code", "value", "time", NULL);
+	rb_gc_register_address(&on_frame);
+
+	V_Timer = rb_define_class_under(V_PIOE, "Timer", rb_cObject);
+	rb_undef_alloc_func(V_Timer);
+	rb_define_method(V_Timer, "cancel", m_timer_cancel, -1);
+	rb_define_method(V_Timer, "pending?", m_timer_pending, -1);
+	timers = rb_hash_new();
+	rb_gc_register_address(&timers);
+
+	id_message = rb_intern("message");
+	id_class = rb_intern("class");
+	id_to_s = rb_intern("to_s");
+	id_backtrace = rb_intern("backtrace");
+
+	/* static symbols, never collected */
+	int i;
+	for (i = 0; i < STAT_KEYS; i++)
+		stat_keys[i] = ID2SYM(rb_intern(stat_names[i]));
 
 	return 0;
 }
 
+static VALUE call_on_frame(VALUE args)
+{
+	return rb_proc_call(on_frame, args);
+}
+
 PE_EXPORT int engine_frame(pe_frame_t frame)
 {
 	if ((frame.id % 500) == 0) {
@@ -95,6 +187,29 @@ PE_EXPORT int engine_frame(pe_frame_t frame)
 		//int res = ruby_code("puts 'yea'");
 		//LOG_DEBUG("REs: %i", res);
 	}
+
+	if (NIL_P(on_frame))
+		return 0;
+
+	/* hand the whole batch to the script in a single call */
+	VALUE events = rb_ary_new_capa(frame.events_len);
+	size_t i;
+	for (i = 0; i < frame.events_len; i++) {
+		const pe_event_t *ev = &frame.events[i];
+		rb_ary_push(events, rb_struct_new(V_Event,
+						  UINT2NUM(ev->device),
+						  UINT2NUM(ev->type),
+						  UINT2NUM(ev->code),
+						  INT2NUM(ev->value),
+						  ULL2NUM(ev->time)));
+	}
+
+	int error;
+	rb_protect(call_on_frame,
+		   rb_ary_new_from_args(2, ULL2NUM(frame.id), events), &error);
+	if (error)
+		return handle_exception();
+
 	return 0;
 }
 
@@ -188,11 +303,11 @@ static int handle_exception()
 	if (exception == Qnil)
 		return 0;
 
-	VALUE m = rb_funcall(exception, rb_intern("message"), 0);
-	VALUE c = rb_funcall(exception, rb_intern("class"), 0);
-	c = rb_funcall(c, rb_intern("to_s"), 0);
-	VALUE b = rb_funcall(exception, rb_intern("backtrace"), 0);
-	b = rb_funcall(b, rb_intern("to_s"), 0);
+	VALUE m = rb_funcall(exception, id_message, 0);
+	VALUE c = rb_funcall(exception, id_class, 0);
+	c = rb_funcall(c, id_to_s, 0);
+	VALUE b = rb_funcall(exception, id_backtrace, 0);
+	b = rb_funcall(b, id_to_s, 0);
 
 	char *err = StringValueCStr(m);
 	char *trace = StringValueCStr(b);
@@ -223,3 +338,118 @@ static VALUE m_frame_id(int argc, const VALUE * argv, VALUE self)
 {
 	return ULL2NUM(pe_engine_frame_id());
 }
+
+static VALUE m_stats(VALUE self)
+{
+	pe_engine_stats_t s;
+	if (pe_engine_stats(engine, &s))
+		return Qnil;
+
+#define STAT(key, val) \
+	rb_hash_aset(h, stat_keys[key], ULL2NUM(val))
+
+	VALUE h = rb_hash_new();
+	STAT(STAT_FRAMES, s.frames);
+	STAT(STAT_SKIPPED, s.skipped);
+	STAT(STAT_OVERRUNS, s.overruns);
+	STAT(STAT_MAX, s.max);
+	STAT(STAT_MEAN, s.frames ? s.total / s.frames : 0);
+	STAT(STAT_P50, pe_engine_stats_percentile(&s, 0.5));
+	STAT(STAT_P99, pe_engine_stats_percentile(&s, 0.99));
+	STAT(STAT_EVENTS, s.events);
+	STAT(STAT_COALESCED, s.coalesced);
+	STAT(STAT_DROPPED, s.dropped);
+	STAT(STAT_QUEUE_HIGH, s.queue_high);
+#undef STAT
+
+	return h;
+}
+
+static VALUE m_on_frame(VALUE self)
+{
+	rb_need_block();
+	on_frame = rb_block_proc();
+	return Qnil;
+}
+
+static void timer_mark(void *p)
+{
+	rb_timer_t *t = p;
+	rb_gc_mark(t->block);
+}
+
+static void timer_free(void *p)
+{
+	rb_timer_t *t = p;
+	pe_timer_cancel(&(t->timer));
+	pe_pool_release(&timer_pool, t);
+}
+
+static VALUE call_timer(VALUE block)
+{
+	return rb_proc_call(block, rb_ary_new());
+}
+
+static void timer_fire(pe_timer_t * timer)
+{
+	rb_timer_t *t = timer->data;
+	VALUE self = t->self;	/* on the stack, stays alive for the call */
+
+	rb_hash_delete(timers, self);
+
+	int error;
+	rb_protect(call_timer, t->block, &error);
+	if (error)
+		handle_exception();
+}
+
+static VALUE schedule(pe_timer_unit_t unit, int argc, const VALUE * argv)
+{
+	VALUE n;
+	rb_timer_t *t;
+
+	rb_scan_args(argc, argv, "1", &n);
+	rb_need_block();
+
+	t = pe_pool_alloc(&timer_pool);
+	if (t == NULL)
+		rb_raise(rb_eNoMemError, "could not allocate timer");
+	t->block = Qnil;
+	pe_timer_init(&(t->timer), timer_fire, t);
+	VALUE self = TypedData_Wrap_Struct(V_Timer, &timer_type, t);
+	t->block = rb_block_proc();
+	t->self = self;
+
+	if (pe_engine_timer_add(engine, &(t->timer), unit, NUM2ULL(n)))
+		rb_raise(rb_eRuntimeError, "could not schedule timer");
+
+	rb_hash_aset(timers, self, Qtrue);
+	return self;
+}
+
+static VALUE m_after(int argc, const VALUE * argv, VALUE self)
+{
+	return schedule(TIMER_MS, argc, argv);
+}
+
+static VALUE m_after_frames(int argc, const VALUE * argv, VALUE self)
+{
+	return schedule(TIMER_FRAMES, argc, argv);
+}
+
+static VALUE m_timer_cancel(int argc, const VALUE * argv, VALUE self)
+{
+	rb_timer_t *t;
+	TypedData_Get_Struct(self, rb_timer_t, &timer_type, t);
+
+	rb_hash_delete(timers, self);
+	return pe_timer_cancel(&(t->timer)) ? Qtrue : Qfalse;
+}
+
+static VALUE m_timer_pending(int argc, const VALUE * argv, VALUE self)
+{
+	rb_timer_t *t;
+	TypedData_Get_Struct(self, rb_timer_t, &timer_type, t);
+
+	return pe_timer_pending(&(t->timer)) ? Qtrue : Qfalse;
+}
@@ -0,0 +1,117 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include "pioe/engine/test.h"
+#include "pioe/engine.h"
+#include "pioe/export.h"
+#include "pioe/util.h"
+
+static pe_engine_t *engine;
+
+static pe_event_t events[PE_TESTENGINE_EVENTS];
+static size_t events_len;
+static int delay;
+static uint64_t frames;
+
+PE_EXPORT pe_engine_t *pe_testengine()
+{
+	return engine;
+}
+
+PE_EXPORT size_t pe_testengine_events(const pe_event_t ** out)
+{
+	*out = events;
+	return __atomic_load_n(&events_len, __ATOMIC_ACQUIRE);
+}
+
+static const pe_engine_meta_t meta = {
+	"Test", "0.1.0", "none", "pioetest"
+};
+
+PE_EXPORT const pe_engine_meta_t *engine_meta()
+{
+	return &meta;
+}
+
+PE_EXPORT void pe_testengine_set_delay(int ms)
+{
+	__atomic_store_n(&delay, ms, __ATOMIC_RELAXED);
+}
+
+PE_EXPORT uint64_t pe_testengine_frames()
+{
+	return __atomic_load_n(&frames, __ATOMIC_ACQUIRE);
+}
+
+PE_EXPORT int engine_load(pe_engine_t * p)
+{
+	engine = p;
+	return 0;
+}
+
+PE_EXPORT int engine_unload()
+{
+	return 0;
+}
+
+PE_EXPORT int engine_init()
+{
+	return 0;
+}
+
+PE_EXPORT int engine_frame(pe_frame_t frame)
+{
+	size_t i, n = events_len;
+
+	for (i = 0; i < frame.events_len; i++)
+		if (n < PE_TESTENGINE_EVENTS)
+			events[n++] = frame.events[i];
+	__atomic_store_n(&events_len, n, __ATOMIC_RELEASE);
+	int ms = __atomic_load_n(&delay, __ATOMIC_RELAXED);
+	/* simulations don't sleep, the frame just takes that long */
+	if (ms > 0 && pe_clock_is_virtual())
+		pe_clock_advance(ms * 1000ULL);
+	else if (ms > 0)
+		pe_sleep(ms);
+	__atomic_add_fetch(&frames, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+PE_EXPORT int engine_start()
+{
+	return 0;
+}
+
+PE_EXPORT int engine_stop()
+{
+	return 0;
+}
+
+PE_EXPORT int engine_load_script(const char *content)
+{
+	return 0;
+}
+
+PE_EXPORT int engine_execute_code(const char *code)
+{
+	return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include "pioe/event.h"
+#include "pioe/error.h"
+#include "pioe/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+PE_EXPORT int pe_event_coalescer_init(pe_event_coalescer_t * c,
+				      size_t capacity)
+{
+	size_t size = 1;
+
+	/* keep the table at most half full, so probing stays short */
+	while (size < capacity * 2)
+		size <<= 1;
+
+	c->slots = calloc(size, sizeof(pe_event_slot_t));
+	if (NULL == c->slots)
+		return PE_ERROR(-1, "out of memory");
+
+	c->mask = size - 1;
+	c->gen = 0;
+	return 0;
+}
+
+PE_EXPORT void pe_event_coalescer_free(pe_event_coalescer_t * c)
+{
+	free(c->slots);
+	c->slots = NULL;
+}
+
+static size_t event_hash(const pe_event_t * ev)
+{
+	uint64_t k = ((uint64_t) ev->device << 32) |
+	    ((uint64_t) ev->type << 16) | ev->code;
+
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	return (size_t)k;
+}
+
+static int same_key(const pe_event_t * a, const pe_event_t * b)
+{
+	return a->device == b->device && a->type == b->type
+	    && a->code == b->code;
+}
+
+static void merge(pe_event_t * into, const pe_event_t * ev)
+{
+	if (ev->type == EVENT_REL) {
+		int64_t sum = (int64_t) into->value + ev->value;
+		if (sum > INT32_MAX)
+			sum = INT32_MAX;
+		else if (sum < INT32_MIN)
+			sum = INT32_MIN;
+		into->value = sum;
+	} else {
+		into->value = ev->value;
+	}
+	into->time = ev->time;
+}
+
+PE_EXPORT void pe_event_coalescer_reset(pe_event_coalescer_t * c)
+{
+	/* a new generation frees all slots without clearing the table */
+	if (++c->gen == 0) {
+		memset(c->slots, 0, (c->mask + 1) * sizeof(pe_event_slot_t));
+		c->gen = 1;
+	}
+}
+
+PE_EXPORT int pe_event_coalesce_one(pe_event_coalescer_t * c,
+				    pe_event_t * events, size_t * len,
+				    size_t max, const pe_event_t * ev)
+{
+	pe_event_slot_t *slot = NULL;
+
+	if (ev->type == EVENT_ABS || ev->type == EVENT_REL) {
+		size_t h = event_hash(ev) & c->mask;
+		slot = &c->slots[h];
+		while (slot->gen == c->gen) {
+			if (same_key(&events[slot->index], ev)) {
+				merge(&events[slot->index], ev);
+				return 1;
+			}
+			h = (h + 1) & c->mask;
+			slot = &c->slots[h];
+		}
+	}
+
+	if (*len >= max)
+		return -1;
+
+	if (slot != NULL) {
+		slot->gen = c->gen;
+		slot->index = *len;
+	}
+	events[(*len)++] = *ev;
+	return 0;
+}
+
+PE_EXPORT size_t pe_event_coalesce(pe_event_coalescer_t * c,
+				   pe_event_t * events, size_t len,
+				   uint64_t * collapsed)
+{
+	size_t i, out = 0;
+
+	pe_event_coalescer_reset(c);
+	for (i = 0; i < len; i++) {
+		/* events are compacted in place, take a copy first */
+		pe_event_t ev = events[i];
+		if (pe_event_coalesce_one(c, events, &out, len, &ev) == 1)
+			(*collapsed)++;
+	}
+
+	return out;
+}
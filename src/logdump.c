@@ -0,0 +1,504 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+/**
+ * @brief	pioe-logdump renders binary logs as text
+ *
+ * Reads a file written with --log-binary and prints its lines in the
+ * order they were logged, formatted with a log format like --log-format.
+ *
+ * @date	10/17/2026
+ * @file	logdump.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pioe/binlog.h"
+#include "pioe/logger.h"
+
+struct site {
+	pe_loglevel_t level;
+	unsigned int line;
+	uint8_t nargs;
+	uint8_t types[PE_LOG_SITE_ARGS];
+	char *format;
+	char *file;
+	char *func;
+};
+
+struct entry {
+	const unsigned char *rec;
+	uint64_t usec;
+	size_t seq;
+};
+
+struct arg {
+	pe_log_arg_t type;
+	int64_t i;
+	double d;
+	char *s;
+};
+
+/* an BINLOG_ENTRY or BINLOG_TEXT record */
+struct line {
+	pe_log_line_t l;
+	const struct site *site;
+	struct arg args[PE_LOG_SITE_ARGS];
+	char *file, *func, *message;
+};
+
+struct reader {
+	const unsigned char *p;
+	const unsigned char *end;
+	int error;
+};
+
+static char **names;
+static size_t nnames;
+static struct site *sites;
+static size_t nsites;
+static struct entry *entries;
+static size_t nentries, entries_cap;
+
+static void *grow(void *array, size_t *len, size_t index, size_t size)
+{
+	size_t n = *len ? *len : 16;
+
+	if (index < *len)
+		return array;
+	while (n <= index)
+		n *= 2;
+	array = realloc(array, n * size);
+	if (NULL == array) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memset((char *)array + *len * size, 0, (n - *len) * size);
+	*len = n;
+	return array;
+}
+
+static const unsigned char *take(struct reader *r, size_t n)
+{
+	const unsigned char *p = r->p;
+
+	if (r->error || (size_t) (r->end - r->p) < n) {
+		r->error = 1;
+		return NULL;
+	}
+	r->p += n;
+	return p;
+}
+
+static uint64_t get(struct reader *r, size_t size)
+{
+	const unsigned char *p = take(r, size);
+	uint8_t u8;
+	uint16_t u16;
+	uint32_t u32;
+	uint64_t u64 = 0;
+
+	if (NULL == p)
+		return 0;
+
+	switch (size) {
+	case 1:
+		memcpy(&u8, p, size);
+		return u8;
+	case 2:
+		memcpy(&u16, p, size);
+		return u16;
+	case 4:
+		memcpy(&u32, p, size);
+		return u32;
+	}
+	memcpy(&u64, p, size);
+	return u64;
+}
+
+static char *get_str(struct reader *r)
+{
+	size_t len = get(r, 2);
+	const unsigned char *p = take(r, len);
+	char *s;
+
+	if (NULL == p)
+		return NULL;
+	if (NULL == (s = malloc(len + 1))) {
+		fprintf(stderr, "out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	memcpy(s, p, len);
+	s[len] = '\0';
+	return s;
+}
+
+static const char *name(uint32_t id)
+{
+	if (id < nnames && names[id] != NULL)
+		return names[id];
+	return "?";
+}
+
+static void line_free(struct line *ln)
+{
+	int i;
+
+	for (i = 0; ln->site != NULL && i < ln->site->nargs; i++)
+		free(ln->args[i].s);
+	free(ln->file);
+	free(ln->func);
+	free(ln->message);
+}
+
+/* r is at the type byte of an entry or text record */
+static int read_line(struct reader *r, struct line *ln)
+{
+	uint8_t type = get(r, 1);
+	uint32_t id;
+	int i;
+
+	memset(ln, 0, sizeof(*ln));
+
+	if (type == BINLOG_ENTRY) {
+		id = get(r, 4);
+		if (id >= nsites || NULL == sites[id].format)
+			return r->error = 1;
+		ln->site = &sites[id];
+		ln->l.level = ln->site->level;
+		ln->l.line = ln->site->line;
+		ln->l.file = ln->site->file;
+		ln->l.func = ln->site->func;
+	} else {
+		ln->l.level = get(r, 1);
+	}
+
+	ln->l.name = name(get(r, 4));
+	ln->l.usec = get(r, 8);
+	ln->l.frame = get(r, 8);
+	ln->l.thread = get(r, 4);
+
+	if (type == BINLOG_TEXT) {
+		ln->l.line = get(r, 4);
+		ln->l.file = ln->file = get_str(r);
+		ln->l.func = ln->func = get_str(r);
+		ln->l.message = ln->message = get_str(r);
+		return r->error;
+	}
+
+	for (i = 0; i < ln->site->nargs; i++) {
+		struct arg *a = &ln->args[i];
+		uint64_t v;
+
+		a->type = ln->site->types[i];
+		switch (a->type) {
+		case LOG_ARG_INT:
+			a->i = (int32_t) get(r, 4);
+			break;
+		case LOG_ARG_DOUBLE:
+			v = get(r, 8);
+			memcpy(&a->d, &v, sizeof(v));
+			break;
+		case LOG_ARG_STRING:
+			a->s = get_str(r);
+			break;
+		default:
+			a->i = get(r, 8);
+		}
+	}
+
+	return r->error;
+}
+
+static int by_time(const void *a, const void *b)
+{
+	const struct entry *x = a, *y = b;
+
+	if (x->usec != y->usec)
+		return x->usec < y->usec ? -1 : 1;
+	return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+/* keeps names and sites, collects entries to be sorted and rendered */
+static int scan(const unsigned char *data, size_t len)
+{
+	struct reader r = { data, data + len, 0 };
+	struct line ln;
+	struct site *s;
+	uint32_t id;
+
+	while (r.p < r.end && !r.error) {
+		const unsigned char *rec = r.p;
+
+		switch (*rec) {
+		case BINLOG_NAME:
+			take(&r, 1);
+			id = get(&r, 4);
+			names = grow(names, &nnames, id, sizeof(char *));
+			free(names[id]);
+			names[id] = get_str(&r);
+			break;
+		case BINLOG_SITE:
+			take(&r, 1);
+			id = get(&r, 4);
+			sites = grow(sites, &nsites, id, sizeof(struct site));
+			s = &sites[id];
+			s->level = get(&r, 1);
+			s->line = get(&r, 4);
+			s->nargs = get(&r, 1);
+			if (s->nargs > PE_LOG_SITE_ARGS
+			    || NULL == take(&r, s->nargs)) {
+				r.error = 1;
+				break;
+			}
+			memcpy(s->types, r.p - s->nargs, s->nargs);
+			s->format = get_str(&r);
+			s->file = get_str(&r);
+			s->func = get_str(&r);
+			break;
+		case BINLOG_ENTRY:
+		case BINLOG_TEXT:
+			read_line(&r, &ln);
+			line_free(&ln);
+			if (r.error)
+				break;
+			entries = grow(entries, &entries_cap, nentries,
+				       sizeof(struct entry));
+			entries[nentries].rec = rec;
+			entries[nentries].usec = ln.l.usec;
+			entries[nentries].seq = nentries;
+			nentries++;
+			break;
+		default:
+			r.error = 1;
+		}
+	}
+
+	return r.error ? -1 : 0;
+}
+
+/* copies text up to end, "%%" becomes '%' */
+static size_t literal(char *buf, size_t n, size_t size, const char *p,
+		      const char *end)
+{
+	for (; p < end && n < size - 1; p++) {
+		buf[n++] = *p;
+		if (*p == '%' && p + 1 < end && p[1] == '%')
+			p++;
+	}
+	buf[n] = '\0';
+	return n;
+}
+
+#define PRINT(v) (nstars == 0 ? snprintf(o, room, spec, v) : \
+		  nstars == 1 ? snprintf(o, room, spec, stars[0], v) : \
+		  snprintf(o, room, spec, stars[0], stars[1], v))
+
+/* runs the conversions of the format one by one with the stored args */
+static void message(const struct line *ln, char *buf, size_t size)
+{
+	const char *format = ln->site->format;
+	const char *p = format;
+	const char *conv;
+	const struct arg *a;
+	pe_log_arg_t types[3];
+	char spec[64];
+	int stars[2];
+	size_t len, n = 0, room;
+	int ntypes, nstars, k = 0, w;
+	char *o;
+
+	buf[0] = '\0';
+	while ((conv = pe_binlog_spec(p, &len, types, &ntypes)) != NULL) {
+		n = literal(buf, n, size, p, conv);
+		p = conv + len;
+		if (ntypes <= 0 || len >= sizeof(spec)
+		    || k + ntypes > ln->site->nargs)
+			break;
+
+		memcpy(spec, conv, len);
+		spec[len] = '\0';
+		for (nstars = 0; nstars < ntypes - 1; nstars++)
+			stars[nstars] = ln->args[k++].i;
+		a = &ln->args[k++];
+
+		o = buf + n;
+		room = size - n;
+		switch (a->type) {
+		case LOG_ARG_INT:
+			w = PRINT((int)a->i);
+			break;
+		case LOG_ARG_LONG:
+			w = PRINT((long)a->i);
+			break;
+		case LOG_ARG_LLONG:
+			w = PRINT((long long)a->i);
+			break;
+		case LOG_ARG_INTMAX:
+			w = PRINT((intmax_t) a->i);
+			break;
+		case LOG_ARG_SIZE:
+			w = PRINT((size_t) a->i);
+			break;
+		case LOG_ARG_PTRDIFF:
+			w = PRINT((ptrdiff_t) a->i);
+			break;
+		case LOG_ARG_DOUBLE:
+			w = PRINT(a->d);
+			break;
+		case LOG_ARG_POINTER:
+			w = PRINT((void *)(uintptr_t) a->i);
+			break;
+		default:
+			w = PRINT(a->s);
+		}
+
+		if (w < 0)
+			w = 0;
+		n += (size_t) w < room ? (size_t) w : room - 1;
+	}
+	literal(buf, n, size, p, p + strlen(p));
+}
+
+static void usage(FILE * out)
+{
+	fprintf(out,
+		"Usage: pioe-logdump [OPTION]... FILE\n"
+		"Print a binary log written with pioe --log-binary as text.\n\n"
+		"  -f, --format=FORMAT  log format, see pioe --log-format\n"
+		"      --format-date=FORMAT\n"
+		"      --format-time=FORMAT\n"
+		"  -h, --help           print this help and exit\n");
+}
+
+static char *option(int argc, char *argv[], int *i, const char *s,
+		    const char *l)
+{
+	size_t len = strlen(l);
+
+	if (s != NULL && strcmp(argv[*i], s) == 0 && *i + 1 < argc)
+		return argv[++*i];
+	if (strncmp(argv[*i], l, len) == 0 && argv[*i][len] == '=')
+		return argv[*i] + len + 1;
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL;
+	unsigned char *data;
+	char msg[LOGGER_MAX_LEN];
+	char out[LOGGER_MAX_LEN];
+	struct reader r;
+	struct line ln;
+	uint32_t version;
+	FILE *fp;
+	long size;
+	size_t i, n;
+	char *v;
+	int a;
+
+	pe_logger_init(stdout, stdout);
+
+	for (a = 1; a < argc; a++) {
+		if (strcmp(argv[a], "-h") == 0
+		    || strcmp(argv[a], "--help") == 0) {
+			usage(stdout);
+			return EXIT_SUCCESS;
+		} else if ((v = option(argc, argv, &a, "-f", "--format"))) {
+			if (pe_logger_set_format(v)) {
+				fprintf(stderr, "Invalid format: %s\n", v);
+				return EXIT_FAILURE;
+			}
+		} else if ((v = option(argc, argv, &a, NULL,
+				       "--format-date"))) {
+			pe_logger_set_format_date(v);
+		} else if ((v = option(argc, argv, &a, NULL,
+				       "--format-time"))) {
+			pe_logger_set_format_time(v);
+		} else if (argv[a][0] == '-' || path != NULL) {
+			usage(stderr);
+			return EXIT_FAILURE;
+		} else {
+			path = argv[a];
+		}
+	}
+
+	if (NULL == path) {
+		usage(stderr);
+		return EXIT_FAILURE;
+	}
+
+	if (NULL == (fp = fopen(path, "rb"))
+	    || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0
+	    || fseek(fp, 0, SEEK_SET)) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+
+	data = malloc(size + 1);
+	if (NULL == data || fread(data, 1, size, fp) != (size_t) size) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	fclose(fp);
+
+	if (size >= PE_BINLOG_MAGIC_LEN + 4)
+		memcpy(&version, data + PE_BINLOG_MAGIC_LEN, sizeof(version));
+	if (size < PE_BINLOG_MAGIC_LEN + 4
+	    || memcmp(data, PE_BINLOG_MAGIC, PE_BINLOG_MAGIC_LEN) != 0
+	    || version != PE_BINLOG_VERSION) {
+		fprintf(stderr, "%s: not a pioe binary log\n", path);
+		return EXIT_FAILURE;
+	}
+
+	/* a log cut off by a crash is printed up to the last full record */
+	if (scan(data + PE_BINLOG_MAGIC_LEN + 4,
+		 size - PE_BINLOG_MAGIC_LEN - 4))
+		fprintf(stderr, "%s: damaged or truncated after %zu lines\n",
+			path, nentries);
+
+	/* threads append whole buffers, so the file is not in order */
+	qsort(entries, nentries, sizeof(struct entry), by_time);
+
+	for (i = 0; i < nentries; i++) {
+		r.p = entries[i].rec;
+		r.end = data + size;
+		r.error = 0;
+		read_line(&r, &ln);
+
+		if (ln.site != NULL) {
+			message(&ln, msg, sizeof(msg));
+			ln.l.message = msg;
+		}
+
+		n = pe_logger_render(pe_logger_core(), &ln.l, out, sizeof(out));
+		out[n++] = '\n';
+		fwrite(out, 1, n, stdout);
+		line_free(&ln);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -24,6 +24,9 @@
 #include "pioe/error.h"
 #include "pioe/engine.h"
 #include "pioe/util.h"
+#include "pioe/queue.h"
+#include "pioe/thread.h"
+#include "pioe/binlog.h"
 #include <sys/time.h>
 #include <time.h>
 #include <math.h>
@@ -33,6 +36,7 @@
 #include <inttypes.h>
 
 static char *default_format = LOGGER_FORMAT_DEFAULT;
+static pe_log_format_t *default_program;
 static char *default_format_date = LOGGER_FORMAT_DATE;
 static char *default_format_time = LOGGER_FORMAT_TIME;
 
@@ -41,9 +45,51 @@ static pe_logger_t core_logger;
 static pe_loglevel_t default_level =
     LINFO | LWARNING | LERROR | LFATAL | LCRITICAL;
 
-static pe_list_t *loggers = NULL;
+PE_VEC_DECLARE(pe_logger_vec, pe_logger_t *, 8)
 
-static char *_get_strftime(time_t * rawtime, char *format, size_t len);
+static pe_logger_vec_t loggers;
+
+/*
+ * Staging: threads that enabled it collect lines in their own buffer and
+ * write them as one block, so they do not take the FILE lock per line
+ * and lines of different threads never interleave.
+ */
+#define LOGGER_STAGE_SIZE (16 * 1024)
+
+struct log_stage {
+	FILE *out;
+	size_t len;
+	char buf[LOGGER_STAGE_SIZE];
+};
+
+static PE_THREAD_LOCAL struct log_stage *stage;
+
+/*
+ * Asynchronous mode: callers copy finished lines into an MPMC queue and
+ * a single writer thread does all I/O. A record without out stops the
+ * writer.
+ */
+struct log_record {
+	FILE *out;
+	size_t len;
+	char line[LOGGER_MAX_LEN];
+};
+
+#define LOGGER_BATCH 32
+
+static pe_queue_t *async_queue;
+static pe_queue_t *async_writer_queue;	/* stays set until the join */
+static pe_log_overflow_t async_overflow;
+static pe_thread_t async_thread;
+static uint64_t async_pushed;
+static uint64_t async_dropped;
+/* threads between reading async_queue and pushing to it */
+static unsigned int async_producers;
+
+/* lines written so far, guarded by flush_mutex */
+static uint64_t async_written;
+static pe_mutex_t flush_mutex;
+static pe_cond_t flush_cond;
 
 static char *strlevel(pe_loglevel_t level)
 {
@@ -67,162 +113,619 @@ static char *strlevel(pe_loglevel_t level)
 
 PE_EXPORT int pe_logger_init(FILE * out, FILE * err)
 {
-	pe_list_init(loggers, pe_logger_t *, 0);
+	pe_logger_vec_init(&loggers);
 	pe_logger_new(&core_logger, "core");
 	core_logger.out = out;
 	core_logger.err = err;
 	return 0;
 }
 
-PE_EXPORT void
-pe_logger(pe_logger_t logger, pe_loglevel_t level, const char *filepath,
-	  const char *func, unsigned int line, char *format, ...)
-{
-#ifdef LOGGER_DISABLE
-	return;
-#else
+/*
+ * A log format is compiled once into a list of ops. LOG_OP_LITERAL
+ * copies a span of the format string, all other ops expand one format
+ * variable.
+ */
+enum log_op_type {
+	LOG_OP_LITERAL,
+	LOG_OP_DATE,
+	LOG_OP_TIME,
+	LOG_OP_MSEC,
+	LOG_OP_FRAME,
+	LOG_OP_THREAD,
+	LOG_OP_NAME,
+	LOG_OP_LEVEL,
+	LOG_OP_FILE,
+	LOG_OP_FUNC,
+	LOG_OP_LINE,
+	LOG_OP_MESSAGE,
+};
 
-#ifndef LOGGER_DEBUG
-	if (logger.level == LDEBUG)
-		return;
-#endif
+struct log_op {
+	enum log_op_type type;
+	size_t offset;		/* literal span in pe_log_format.source */
+	size_t len;
+};
 
-	if (logger.level != LALL && 0 == (logger.level & level))
-		return;
+struct pe_log_format {
+	char *source;
+	bool needs_tm;		/* has date or time ops */
+	size_t len;
+	struct log_op ops[];
+};
 
-	char mbuf[LOGGER_MAX_LEN];
+static pe_log_format_t *log_format_compile(const char *format)
+{
+	pe_log_format_t *f;
+	struct log_op *op;
+	const char *p;
+	size_t max = 1;
 
-	va_list list;
-	va_start(list, format);
-	vsnprintf(mbuf, LOGGER_MAX_LEN, format, list);
-	va_end(list);
+	for (p = format; *p != '\0'; p++)
+		max++;
 
-	// see logger.h enum. Everything below LWARNING should go to err out
-	FILE *out = NULL;
-	if (level < LWARNING) {
-		out = logger.err;
-	} else {
-		out = logger.out;
+	f = calloc(1, sizeof(pe_log_format_t) + max * sizeof(struct log_op));
+	if (NULL == f || NULL == (f->source = strdup(format))) {
+		free(f);
+		PE_ERROR(-1, "out of memory");
+		return NULL;
 	}
 
-	if (NULL == out)
-		PE_ABORT(-255, "Output must not be NULL");
+	for (p = f->source; *p != '\0'; p++) {
+		op = &f->ops[f->len];
 
-	char *p;
-	char fbuf[LOGGER_MAX_LEN] = { '\0' };
-	size_t findex = 0;
-	size_t foffset = 0;
-	char *tmp;
-	time_t rawtime;
-	time(&rawtime);
-	int msec;
-	struct timeval tv;
-
-	gettimeofday(&tv, NULL);
-	msec = lrint(tv.tv_usec / 1000.0);
-	if (msec >= 1000)
-		msec -= 1000;
-
-#define REPL_TIME(format,len) \
-	tmp = _get_strftime(&rawtime, format, len); \
-	strcat(fbuf, tmp); \
-	findex += strlen(tmp); \
-	free(tmp); \
-	tmp = NULL;
-
-#define REPL_NUM(format, num) \
-	tmp = calloc(sizeof(char), 32); \
-	sprintf(tmp, format, num); \
-	strcat(fbuf, tmp);\
-	findex += strlen(tmp); \
-	free(tmp); \
-	tmp = NULL;
-
-#define REPL_STR(str) \
-	strcat(fbuf, str); \
-	findex += strlen(str);
-
-	for (p = logger.format; *p != '\0'; p++) {
-		if (*p == '%') {
-			p++;
-		} else {
-			fbuf[findex++] = *p;
+		if (*p != '%' || p[1] == '%') {
+			/* a literal "%%" is the span of its second '%' */
+			if (*p == '%')
+				p++;
+			if (f->len > 0 && op[-1].type == LOG_OP_LITERAL
+			    && op[-1].offset + op[-1].len == p - f->source) {
+				op[-1].len++;
+				continue;
+			}
+			op->type = LOG_OP_LITERAL;
+			op->offset = p - f->source;
+			op->len = 1;
+			f->len++;
 			continue;
 		}
 
-		switch (*p) {
-		case '%':
-			fbuf[findex++] = '%';
-			break;
+		switch (*++p) {
 		case 'D':
-			REPL_TIME(logger.format_date, 32);
+			op->type = LOG_OP_DATE;
+			f->needs_tm = true;
 			break;
 		case 'T':
-			REPL_TIME(logger.format_time, 32);
+			op->type = LOG_OP_TIME;
+			f->needs_tm = true;
 			break;
 		case 'X':
-			REPL_NUM("%03d", msec);
+			op->type = LOG_OP_MSEC;
 			break;
 		case 'F':
-			REPL_NUM("%" PRIu64, pe_engine_frame_id());
+			op->type = LOG_OP_FRAME;
+			break;
+		case 't':
+			op->type = LOG_OP_THREAD;
 			break;
 		case 'N':
-			REPL_STR(logger.name);
+			op->type = LOG_OP_NAME;
 			break;
 		case 'L':
-			REPL_STR(strlevel(level));
+			op->type = LOG_OP_LEVEL;
 			break;
 		case 'f':
-			REPL_STR(filepath);
+			op->type = LOG_OP_FILE;
 			break;
 		case 'm':
-			REPL_STR(func);
+			op->type = LOG_OP_FUNC;
 			break;
 		case 'l':
-			REPL_NUM("%d", line);
+			op->type = LOG_OP_LINE;
 			break;
 		case 'M':
-			REPL_STR(mbuf);
+			op->type = LOG_OP_MESSAGE;
 			break;
+		case '\0':
+			free(f->source);
+			free(f);
+			PE_ERROR(-1, "Log format ends with '%%': %s", format);
+			return NULL;
 		default:
-			fprintf(stderr, "Log format error: %%%c - %s\n", *p,
-				logger.format);
-			fflush(stderr);
-			exit(EXIT_FAILURE);
+			PE_ERROR(-1, "Log format error: %%%c - %s", *p, format);
+			free(f->source);
+			free(f);
+			return NULL;
 		}
+		f->len++;
 	}
 
-	fprintf(out, "%s\n", fbuf);
-	fflush(out);
+	return f;
+}
+
+/*
+ * %D and %T only change once a second, so each thread keeps them
+ * formatted for the second it logged last.
+ */
+struct log_time_cache {
+	time_t second;
+	const char *format_date;
+	const char *format_time;
+	size_t date_len;
+	size_t time_len;
+	char date[64];
+	char time[64];
+};
+
+static PE_THREAD_LOCAL struct log_time_cache time_cache = {.second = -1 };
+
+static const struct log_time_cache *log_time(const pe_logger_t * logger,
+					     time_t second)
+{
+	struct log_time_cache *c = &time_cache;
+	struct tm tm;
+
+	if (c->second == second && c->format_date == logger->format_date
+	    && c->format_time == logger->format_time)
+		return c;
+
+#ifdef _WIN32
+	localtime_s(&tm, &second);
+#else
+	localtime_r(&second, &tm);
 #endif
+	c->date_len = strftime(c->date, sizeof(c->date), logger->format_date,
+			       &tm);
+	c->time_len = strftime(c->time, sizeof(c->time), logger->format_time,
+			       &tm);
+	c->second = second;
+	c->format_date = logger->format_date;
+	c->format_time = logger->format_time;
+	return c;
+}
+
+/* appends at most what fits into size, always keeps buf terminated */
+static size_t put(char *buf, size_t n, size_t size, const char *s,
+		  size_t len)
+{
+	if (len > size - 1 - n)
+		len = size - 1 - n;
+	memcpy(buf + n, s, len);
+	n += len;
+	buf[n] = '\0';
+	return n;
+}
+
+static size_t put_str(char *buf, size_t n, size_t size, const char *s)
+{
+	return put(buf, n, size, s, strlen(s));
+}
+
+/* snprintf() and vsnprintf() return what they wanted to write */
+static size_t clamp(int written, size_t n, size_t size)
+{
+	if (written < 0)
+		return n;
+	if ((size_t) written > size - 1 - n)
+		return size - 1;
+	return n + written;
+}
+
+PE_EXPORT size_t pe_logger_render(const pe_logger_t * logger,
+				 const pe_log_line_t * l, char *buf,
+				 size_t size)
+{
+	const pe_log_format_t *f = logger->program;
+	const struct log_op *op;
+	const struct log_time_cache *tc = NULL;
+	time_t rawtime = l->usec / 1000000;
+	int msec = (l->usec % 1000000) / 1000;
+	size_t n = 0;
+	size_t i;
+	va_list copy;
+	char digits[3];
+
+	buf[0] = '\0';
+
+	if (f->needs_tm)
+		tc = log_time(logger, rawtime);
+
+	for (i = 0; i < f->len; i++) {
+		op = &f->ops[i];
+
+		switch (op->type) {
+		case LOG_OP_LITERAL:
+			n = put(buf, n, size, f->source + op->offset, op->len);
+			break;
+		case LOG_OP_DATE:
+			n = put(buf, n, size, tc->date, tc->date_len);
+			break;
+		case LOG_OP_TIME:
+			n = put(buf, n, size, tc->time, tc->time_len);
+			break;
+		case LOG_OP_MSEC:
+			digits[0] = '0' + msec / 100;
+			digits[1] = '0' + msec / 10 % 10;
+			digits[2] = '0' + msec % 10;
+			n = put(buf, n, size, digits, 3);
+			break;
+		case LOG_OP_FRAME:
+			n = clamp(snprintf(buf + n, size - n, "%" PRIu64,
+					   l->frame), n, size);
+			break;
+		case LOG_OP_THREAD:
+			n = clamp(snprintf(buf + n, size - n, "%u", l->thread),
+				  n, size);
+			break;
+		case LOG_OP_NAME:
+			n = put_str(buf, n, size, l->name);
+			break;
+		case LOG_OP_LEVEL:
+			n = put_str(buf, n, size, strlevel(l->level));
+			break;
+		case LOG_OP_FILE:
+			n = put_str(buf, n, size, l->file);
+			break;
+		case LOG_OP_FUNC:
+			n = put_str(buf, n, size, l->func);
+			break;
+		case LOG_OP_LINE:
+			n = clamp(snprintf(buf + n, size - n, "%u", l->line), n,
+				  size);
+			break;
+		case LOG_OP_MESSAGE:
+			if (NULL == l->format) {
+				n = put_str(buf, n, size, l->message);
+				break;
+			}
+			va_copy(copy, *l->args);
+			n = clamp(vsnprintf(buf + n, size - n, l->format, copy),
+				  n, size);
+			va_end(copy);
+			break;
+		}
+	}
+
+	return n;
 }
 
-static char *_get_strftime(time_t * rawtime, char *format, size_t len)
+static bool log_enabled(const pe_logger_t * logger, pe_loglevel_t level)
 {
-	struct tm *timeinfo;
-	char buf[len];
-	timeinfo = localtime(rawtime);
-	strftime(buf, len, format, timeinfo);
-	return strdup(buf);
+#ifdef LOGGER_DISABLE
+	return false;
+#else
+
+#ifndef LOGGER_DEBUG
+	if (logger->level == LDEBUG)
+		return false;
+#endif
+
+	return logger->level == LALL || 0 != (logger->level & level);
+#endif
+}
+
+/* formats the line and writes it, or hands it to the writer thread */
+static void log_text(pe_logger_t * logger, pe_loglevel_t level,
+		     const char *filepath, const char *func,
+		     unsigned int line, const char *format, va_list * args)
+{
+	// see logger.h enum. Everything below LWARNING should go to err out
+	FILE *out = NULL;
+	if (level < LWARNING) {
+		out = logger->err;
+	} else {
+		out = logger->out;
+	}
+
+	if (NULL == out)
+		PE_ABORT(-255, "Output must not be NULL");
+
+	/* the newline replaces the terminating '\0' */
+	char fbuf[LOGGER_MAX_LEN];
+	size_t len;
+	pe_log_line_t l = {
+		.level = level,
+		.name = logger->name,
+		.file = filepath,
+		.func = func,
+		.line = line,
+		/* follows the virtual clock of simulations */
+		.usec = pe_tstamp_usec(),
+		.frame = pe_engine_frame_id(),
+		.thread = pe_thread_id(),
+		.format = format,
+		.args = args,
+	};
+
+	len = pe_logger_render(logger, &l, fbuf, LOGGER_MAX_LEN);
+	fbuf[len++] = '\n';
+
+	/* seq_cst pairs with pe_logger_async_stop(): either it waits for
+	 * us or we see that the queue is gone */
+	__atomic_add_fetch(&async_producers, 1, __ATOMIC_SEQ_CST);
+	pe_queue_t *q = __atomic_load_n(&async_queue, __ATOMIC_SEQ_CST);
+	if (q != NULL) {
+		struct log_record r;
+		int rc;
+
+		r.out = out;
+		r.len = len;
+		memcpy(r.line, fbuf, len);
+
+		if (async_overflow == LOG_OVERFLOW_DROP)
+			rc = pe_queue_try_push(q, &r);
+		else
+			rc = pe_queue_push(q, &r);
+		__atomic_sub_fetch(&async_producers, 1, __ATOMIC_RELEASE);
+
+		if (rc == 0)
+			__atomic_add_fetch(&async_pushed, 1, __ATOMIC_RELEASE);
+		else
+			__atomic_add_fetch(&async_dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	__atomic_sub_fetch(&async_producers, 1, __ATOMIC_RELEASE);
+
+	if (stage != NULL) {
+		if (stage->out != out || LOGGER_STAGE_SIZE - stage->len < len)
+			pe_logger_thread_flush();
+		stage->out = out;
+		memcpy(stage->buf + stage->len, fbuf, len);
+		stage->len += len;
+
+		/* do not keep errors back */
+		if (level < LWARNING)
+			pe_logger_thread_flush();
+		return;
+	}
+
+	fwrite(fbuf, 1, len, out);
+	fflush(out);
+}
+
+PE_EXPORT int pe_logger_thread_buffered(bool enable)
+{
+	if (!enable) {
+		pe_logger_thread_flush();
+		free(stage);
+		stage = NULL;
+		return 0;
+	}
+
+	if (stage != NULL)
+		return 0;
+
+	stage = malloc(sizeof(struct log_stage));
+	if (NULL == stage)
+		return PE_ERROR(-1, "out of memory");
+	stage->out = NULL;
+	stage->len = 0;
+	return 0;
+}
+
+PE_EXPORT void pe_logger_thread_flush()
+{
+	if (NULL == stage || stage->len == 0)
+		return;
+
+	fwrite(stage->buf, 1, stage->len, stage->out);
+	fflush(stage->out);
+	stage->len = 0;
+}
+
+PE_EXPORT void
+pe_logger(pe_logger_t logger, pe_loglevel_t level, const char *filepath,
+	  const char *func, unsigned int line, char *format, ...)
+{
+	va_list list;
+
+	if (!log_enabled(&logger, level))
+		return;
+
+	va_start(list, format);
+	if (pe_binlog_text(&logger, level, filepath, func, line, format,
+			   &list))
+		log_text(&logger, level, filepath, func, line, format, &list);
+	va_end(list);
+}
+
+PE_EXPORT void
+pe_logger_site(pe_log_site_t * site, pe_logger_t logger,
+	       pe_loglevel_t level, const char *filepath, const char *func,
+	       unsigned int line, char *format, ...)
+{
+	va_list list;
+
+	if (!log_enabled(&logger, level))
+		return;
+
+	va_start(list, format);
+	if (pe_binlog_entry(site, &logger, level, filepath, func, line,
+			    format, &list))
+		log_text(&logger, level, filepath, func, line, format, &list);
+	va_end(list);
+}
+
+static void *async_writer(void *data)
+{
+	struct log_record *batch = data;
+	/* async_queue is cleared before the stop record is pushed */
+	pe_queue_t *q = async_writer_queue;
+	FILE *touched[LOGGER_BATCH];
+	size_t ntouched, n, i, j;
+	bool stop = false;
+
+	while (!stop) {
+		n = pe_queue_pop_batch(q, batch, LOGGER_BATCH);
+		ntouched = 0;
+
+		for (i = 0; i < n; i++) {
+			if (batch[i].out == NULL) {
+				stop = true;
+				continue;
+			}
+
+			fwrite(batch[i].line, 1, batch[i].len, batch[i].out);
+
+			for (j = 0; j < ntouched; j++)
+				if (touched[j] == batch[i].out)
+					break;
+			if (j == ntouched)
+				touched[ntouched++] = batch[i].out;
+		}
+
+		for (j = 0; j < ntouched; j++)
+			fflush(touched[j]);
+
+		pe_mutex_lock(&flush_mutex);
+		async_written += stop ? n - 1 : n;
+		pe_cond_broadcast(&flush_cond);
+		pe_mutex_unlock(&flush_mutex);
+	}
+
+	free(batch);
+	return NULL;
+}
+
+static void async_warn_dropped()
+{
+	if (async_dropped > 0)
+		LOG_WARN("Dropped %" PRIu64 " log lines, the log queue was full",
+			 async_dropped);
+}
+
+/*
+ * Threads may still log while exit() runs the atexit handlers, so the
+ * queue must stay: freeing it would let them push into freed memory,
+ * and with the writer gone a full queue would block them forever.
+ * Only write out what is queued.
+ */
+static void async_exit()
+{
+	if (__atomic_load_n(&async_queue, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	pe_logger_flush();
+	async_warn_dropped();
+	pe_logger_flush();
+}
+
+PE_EXPORT int pe_logger_async_start(size_t capacity,
+				    pe_log_overflow_t overflow)
+{
+	static bool registered = false;
+	struct log_record *batch;
+	pe_queue_t *q;
+
+	if (async_queue != NULL)
+		return PE_ERROR(-1, "asynchronous logging already started");
+
+	q = pe_queue_new(capacity, sizeof(struct log_record),
+			 PE_QUEUE_MPMC | PE_QUEUE_BLOCKING);
+	if (NULL == q)
+		return -1;
+
+	batch = malloc(LOGGER_BATCH * sizeof(struct log_record));
+	if (NULL == batch) {
+		pe_queue_free(q);
+		return PE_ERROR(-1, "out of memory");
+	}
+
+	if (!registered) {
+		pe_mutex_init(&flush_mutex);
+		pe_cond_init(&flush_cond);
+		atexit(async_exit);
+		registered = true;
+	}
+
+	async_overflow = overflow;
+	async_pushed = async_written = 0;
+	async_writer_queue = q;
+	async_queue = q;
+
+	if (pe_thread_create(&async_thread, async_writer, batch)) {
+		async_queue = NULL;
+		pe_queue_free(q);
+		free(batch);
+		return PE_ERROR(-1, "could not start the log writer thread");
+	}
+
+	return 0;
+}
+
+PE_EXPORT void pe_logger_flush()
+{
+	uint64_t target = __atomic_load_n(&async_pushed, __ATOMIC_ACQUIRE);
+
+	pe_logger_thread_flush();
+	pe_binlog_flush();
+
+	if (__atomic_load_n(&async_queue, __ATOMIC_ACQUIRE) == NULL)
+		return;
+
+	pe_mutex_lock(&flush_mutex);
+	while (async_written < target)
+		pe_cond_wait(&flush_cond, &flush_mutex);
+	pe_mutex_unlock(&flush_mutex);
+}
+
+/* other threads may keep logging, their lines are written directly */
+PE_EXPORT void pe_logger_async_stop()
+{
+	struct log_record stop = {.out = NULL };
+	pe_queue_t *q = async_queue;
+
+	if (NULL == q)
+		return;
+
+	pe_logger_flush();
+	/* lines logged from here on are written directly */
+	__atomic_store_n(&async_queue, NULL, __ATOMIC_SEQ_CST);
+	/* the writer still runs, so even blocked producers get through */
+	while (__atomic_load_n(&async_producers, __ATOMIC_ACQUIRE) > 0)
+		pe_thread_yield();
+	pe_queue_push(q, &stop);
+	pe_thread_join(async_thread);
+	pe_queue_free(q);
+
+	async_warn_dropped();
+}
+
+PE_EXPORT uint64_t pe_logger_dropped()
+{
+	return __atomic_load_n(&async_dropped, __ATOMIC_RELAXED);
 }
 
 PE_EXPORT int pe_logger_new(pe_logger_t * logger, const char *name)
 {
-	logger->name = strdup(name);
+	logger->name = pe_symbol(name);
 	logger->out = core_logger.out;
 	logger->err = core_logger.err;
+	if (NULL == default_program
+	    && NULL == (default_program = log_format_compile(default_format)))
+		return -1;
+
 	logger->format = default_format;
+	logger->program = default_program;
 	logger->format_date = default_format_date;
 	logger->format_time = default_format_time;
 	logger->level = default_level;
-	pe_list_add(loggers, pe_logger_t *, logger);
+	if (pe_logger_vec_push(&loggers, logger))
+		return PE_ERROR(-1, "out of memory");
 	return 0;
 }
 
 PE_EXPORT int pe_logger_set_format(char *format)
 {
+	pe_log_format_t *program = log_format_compile(format);
+
+	if (NULL == program)
+		return -1;
+
+	/* the old program stays alive, other loggers may still use it */
 	default_format = format;
+	default_program = program;
 	core_logger.format = format;
+	core_logger.program = program;
 	return 0;
 }
 
@@ -22,6 +22,7 @@
 
 #include "pioe/error.h"
 #include "pioe/logger.h"
+#include "pioe/binlog.h"
 #include "pioe/thread.h"
 //#include "pioe/plugin.h"
 #include "pioe/util.h"
@@ -66,8 +67,10 @@ int main(int argc, char *argv[])
 		pe_logger_init(stdout, stdout);
 	}
 
-	if (args_info.log_format_given)
-		pe_logger_set_format(args_info.log_format_arg);
+	if (args_info.log_format_given
+	    && pe_logger_set_format(args_info.log_format_arg))
+		PE_ABORT(-1, "Invalid --log-format: %s",
+			 args_info.log_format_arg);
 
 	if (args_info.log_format_date_given)
 		pe_logger_set_format_date(args_info.log_format_date_arg);
@@ -78,10 +81,30 @@ int main(int argc, char *argv[])
 	if (args_info.debug_flag)
 		pe_logger_set_level(LALL);
 
+	if (args_info.log_binary_given
+	    && pe_logger_binary_open(args_info.log_binary_arg))
+		PE_ABORT(-1, "Could not open --log-binary %s",
+			 args_info.log_binary_arg);
+
+	if (args_info.log_async_flag) {
+		pe_log_overflow_t overflow = LOG_OVERFLOW_BLOCK;
+		if (strcmp(args_info.log_overflow_arg, "drop") == 0)
+			overflow = LOG_OVERFLOW_DROP;
+
+		if (args_info.log_queue_size_arg <= 0
+		    || pe_logger_async_start(args_info.log_queue_size_arg,
+					     overflow))
+			PE_ABORT(-1, "Invalid --log-queue-size: %i",
+				 args_info.log_queue_size_arg);
+	}
+
+	if (args_info.rescan_engines_flag)
+		pe_engine_rescan();
+
 	if (args_info.list_engines_given) {
-		char *result[1024];
+		const pe_engine_info_t *engines;
 		int i;
-		size_t len = pe_engine_find_engines(result);
+		size_t len = pe_engine_list(&engines);
 		if (len == 0) {
 			fprintf(stderr, "No engines found.\n");
 			fflush(stderr);
@@ -89,13 +112,55 @@ int main(int argc, char *argv[])
 		}
 
 		for (i = 0; i < len; i++) {
-			printf("%s\n", result[i]);
+			printf("%-10s %s %s (*.%s) %s\n", engines[i].key,
+			       engines[i].name, engines[i].version,
+			       engines[i].suffix, engines[i].path);
 		}
 
 		exit(EXIT_SUCCESS);
 
 	}
 
+	if (pe_engine_set_frame_rate(args_info.frame_rate_arg))
+		PE_ABORT(-1, "Invalid --frame-rate: %i", args_info.frame_rate_arg);
+
+	if (strcmp(args_info.run_mode_arg, "event") == 0
+	    && pe_engine_set_run_mode(RUN_EVENT))
+		PE_ABORT(-1, "Could not set --run-mode=event");
+
+	pe_engine_set_coalesce(!args_info.no_coalesce_flag);
+
+	pe_queue_policy_t policy = QUEUE_DROP_NEWEST;
+	if (strcmp(args_info.queue_policy_arg, "drop-oldest") == 0)
+		policy = QUEUE_DROP_OLDEST;
+	else if (strcmp(args_info.queue_policy_arg, "coalesce") == 0)
+		policy = QUEUE_COALESCE;
+	else if (strcmp(args_info.queue_policy_arg, "block") == 0)
+		policy = QUEUE_BLOCK;
+
+	if (args_info.queue_capacity_arg <= 0
+	    || pe_engine_set_queue(NULL, args_info.queue_capacity_arg, policy))
+		PE_ABORT(-1, "Invalid --queue-capacity: %i",
+			 args_info.queue_capacity_arg);
+
+	if (args_info.simulate_given
+	    && pe_engine_simulate(args_info.simulate_arg))
+		PE_ABORT(-1, "Invalid --simulate: %li", args_info.simulate_arg);
+
+	if (strcmp(args_info.frame_overrun_arg, "catchup") == 0)
+		pe_engine_set_overrun_policy(OVERRUN_CATCHUP);
+	else
+		pe_engine_set_overrun_policy(OVERRUN_DROP);
+
+	if (args_info.record_given && pe_engine_record(args_info.record_arg))
+		PE_ABORT(-1, "Could not record to %s", args_info.record_arg);
+
+	if (args_info.replay_given
+	    && pe_engine_replay(args_info.replay_arg,
+				strcmp(args_info.replay_speed_arg, "fast") == 0
+				? REPLAY_FAST : REPLAY_RECORDED))
+		PE_ABORT(-1, "Could not replay %s", args_info.replay_arg);
+
 	if (args_info.engine_given > 0) {
 		int i;
 		for (i = 0; i < args_info.engine_given; i++) {
@@ -109,6 +174,20 @@ int main(int argc, char *argv[])
 
 			LOG_INFO("Engine %s loaded.", args_info.engine_arg[i]);
 		}
+
+		for (i = 0; i < args_info.engine_rate_given; i++) {
+			char *name = strdup(args_info.engine_rate_arg[i]);
+			char *hz = strchr(name, ':');
+			if (NULL == hz)
+				PE_ABORT(-1, "Invalid --engine-rate: %s",
+					 args_info.engine_rate_arg[i]);
+			*hz++ = '\0';
+			if (pe_engine_set_engine_rate(name, atoi(hz)))
+				LOG_ERROR("Could not set rate of engine %s",
+					  name);
+			free(name);
+		}
+
 		if (pe_engine_init()) {
 			PE_ABORT(-1, "error foo");
 		}
@@ -139,7 +218,10 @@ int main(int argc, char *argv[])
 
 	LOG_DEBUG("Waiting for engine to finish all threads...");
 	pe_engine_run();
+	pe_engine_quit();
 	LOG_DEBUG("Engine finished all tasks.");
+	/* the engine workers are joined, nothing logs anymore */
+	pe_logger_binary_close();
 
 	return 0;
 }
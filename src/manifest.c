@@ -0,0 +1,465 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include "pioe/manifest.h"
+#include "pioe/engine.h"
+#include "pioe/error.h"
+#include "pioe/logger.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#include <fnmatch.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#define MANIFEST_MAGIC "pioe-engines 1"
+#define MANIFEST_LINE 4096
+
+static void info_free(pe_engine_info_t * e)
+{
+	free(e->key);
+	free(e->path);
+	free(e->name);
+	free(e->version);
+	free(e->suffix);
+}
+
+PE_EXPORT void pe_manifest_free(pe_manifest_t * m)
+{
+	size_t i;
+
+	for (i = 0; i < m->engines.len; i++)
+		info_free(&(pe_engine_info_vec_data(&(m->engines))[i]));
+	for (i = 0; i < m->dirs.len; i++)
+		free(pe_manifest_dir_vec_data(&(m->dirs))[i].path);
+	pe_engine_info_vec_free(&(m->engines));
+	pe_manifest_dir_vec_free(&(m->dirs));
+}
+
+PE_EXPORT const pe_engine_info_t *pe_manifest_find(pe_manifest_t * m,
+						   const char *key)
+{
+	pe_engine_info_t *engines = pe_engine_info_vec_data(&(m->engines));
+	size_t i;
+
+	for (i = 0; i < m->engines.len; i++)
+		if (strcmp(engines[i].key, key) == 0)
+			return &(engines[i]);
+	return NULL;
+}
+
+#ifndef _WIN32
+/* in nanoseconds where available, so changes within a second count */
+static int64_t mtime_of(const struct stat *st)
+{
+#ifdef __linux__
+	return (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+	return st->st_mtime;
+#endif
+}
+
+/* files come and go in the current directory all the time */
+static bool is_cwd(const char *dir)
+{
+	return strcmp(dir, ".") == 0 || strcmp(dir, "./") == 0;
+}
+
+/*
+ * existing search directories as absolute paths, with their mtimes. The
+ * current directory gets 0, so only changing into another one matters.
+ */
+static int resolve_dirs(pe_manifest_dir_vec_t * out, const char *dirs[],
+			size_t ndirs)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	pe_manifest_dir_t d;
+	size_t i;
+
+	for (i = 0; i < ndirs; i++) {
+		if (dirs[i][0] == '\0' || realpath(dirs[i], path) == NULL
+		    || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+			continue;
+
+		d.path = strdup(path);
+		d.mtime = is_cwd(dirs[i]) ? 0 : mtime_of(&st);
+		if (d.path == NULL || pe_manifest_dir_vec_push(out, d)) {
+			free(d.path);
+			return PE_ERROR(-1, "out of memory");
+		}
+	}
+	return 0;
+}
+
+/* split line at tabs into at most n fields, the last one takes the rest */
+static size_t split(char *line, char *fields[], size_t n)
+{
+	size_t i = 0;
+
+	line[strcspn(line, "\n")] = '\0';
+	while (i < n - 1) {
+		fields[i++] = line;
+		line = strchr(line, '\t');
+		if (line == NULL)
+			return i;
+		*line++ = '\0';
+	}
+	fields[i++] = line;
+	return i;
+}
+
+/* empty fields are engines that were not probed yet */
+static char *field(const char *f, bool * oom)
+{
+	char *s;
+
+	if (f[0] == '\0')
+		return NULL;
+	if ((s = strdup(f)) == NULL)
+		*oom = true;
+	return s;
+}
+
+static int manifest_read(pe_manifest_t * m, FILE * fp)
+{
+	char line[MANIFEST_LINE];
+	char *f[8];
+	pe_engine_info_t e;
+	pe_manifest_dir_t d;
+	bool oom;
+
+	if (fgets(line, sizeof(line), fp) == NULL
+	    || strncmp(line, MANIFEST_MAGIC "\n", sizeof(line)) != 0)
+		return -1;
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "dir\t", 4) == 0) {
+			if (split(line, f, 3) != 3)
+				return -1;
+			d.mtime = strtoll(f[1], NULL, 10);
+			d.path = strdup(f[2]);
+			if (d.path == NULL
+			    || pe_manifest_dir_vec_push(&(m->dirs), d)) {
+				free(d.path);
+				return -1;
+			}
+		} else if (strncmp(line, "engine\t", 7) == 0) {
+			if (split(line, f, 8) != 8)
+				return -1;
+			e.mtime = strtoll(f[1], NULL, 10);
+			e.size = strtoll(f[2], NULL, 10);
+			oom = false;
+			e.key = strdup(f[3]);
+			e.name = field(f[4], &oom);
+			e.version = field(f[5], &oom);
+			e.suffix = field(f[6], &oom);
+			e.path = strdup(f[7]);
+			if (!e.key || !e.path || oom
+			    || pe_engine_info_vec_push(&(m->engines), e)) {
+				info_free(&e);
+				return -1;
+			}
+		} else {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static bool manifest_valid(pe_manifest_t * m, const char *dirs[],
+			   size_t ndirs)
+{
+	pe_manifest_dir_vec_t now;
+	pe_manifest_dir_t *a, *b;
+	pe_engine_info_t *e;
+	struct stat st;
+	bool valid = true;
+	size_t i;
+
+	pe_manifest_dir_vec_init(&now);
+	if (resolve_dirs(&now, dirs, ndirs) || now.len != m->dirs.len)
+		valid = false;
+
+	a = pe_manifest_dir_vec_data(&now);
+	b = pe_manifest_dir_vec_data(&(m->dirs));
+	for (i = 0; valid && i < now.len; i++)
+		valid = strcmp(a[i].path, b[i].path) == 0
+		    && a[i].mtime == b[i].mtime;
+
+	e = pe_engine_info_vec_data(&(m->engines));
+	for (i = 0; valid && i < m->engines.len; i++)
+		valid = stat(e[i].path, &st) == 0 && mtime_of(&st) == e[i].mtime
+		    && st.st_size == e[i].size;
+
+	for (i = 0; i < now.len; i++)
+		free(a[i].path);
+	pe_manifest_dir_vec_free(&now);
+	return valid;
+}
+
+PE_EXPORT int pe_manifest_load(pe_manifest_t * m, const char *file,
+			       const char *dirs[], size_t ndirs)
+{
+	FILE *fp;
+	int res;
+
+	pe_engine_info_vec_init(&(m->engines));
+	pe_manifest_dir_vec_init(&(m->dirs));
+
+	fp = fopen(file, "r");
+	if (fp == NULL)
+		return -1;
+	res = manifest_read(m, fp);
+	fclose(fp);
+
+	if (res == 0 && manifest_valid(m, dirs, ndirs))
+		return 0;
+
+	LOG_DEBUG("Engine manifest %s is stale", file);
+	pe_manifest_free(m);
+	return -1;
+}
+
+static int scan_dir(pe_manifest_t * m, const char *dir, const char *prefix,
+		    const char *suffix)
+{
+	char pattern[PATH_MAX];
+	char path[PATH_MAX];
+	size_t plen = strlen(prefix), slen = strlen(suffix), len;
+	struct dirent *dirent;
+	struct stat st;
+	pe_engine_info_t e;
+	DIR *dp;
+
+	snprintf(pattern, sizeof(pattern), "%s*%s", prefix, suffix);
+	dp = opendir(dir);
+	if (dp == NULL)
+		return 0;
+
+	while ((dirent = readdir(dp)) != NULL) {
+		len = strlen(dirent->d_name);
+		if (fnmatch(pattern, dirent->d_name, 0) != 0
+		    || len <= plen + slen)
+			continue;
+
+		memset(&e, 0, sizeof(e));
+		e.key = strndup(dirent->d_name + plen, len - plen - slen);
+		if (e.key == NULL)
+			break;
+		snprintf(path, sizeof(path), "%s/%s", dir, dirent->d_name);
+
+		if (pe_manifest_find(m, e.key) != NULL || stat(path, &st) != 0) {
+			free(e.key);
+			continue;
+		}
+
+		e.path = strdup(path);
+		e.mtime = mtime_of(&st);
+		e.size = st.st_size;
+		if (e.path == NULL
+		    || pe_engine_info_vec_push(&(m->engines), e)) {
+			info_free(&e);
+			break;
+		}
+		LOG_DEBUG("Found engine %s in %s", e.key, path);
+	}
+	closedir(dp);
+	return 0;
+}
+
+PE_EXPORT int pe_manifest_scan(pe_manifest_t * m, const char *dirs[],
+			       size_t ndirs, const char *prefix,
+			       const char *suffix)
+{
+	pe_manifest_dir_t *d;
+	size_t i;
+
+	pe_engine_info_vec_init(&(m->engines));
+	pe_manifest_dir_vec_init(&(m->dirs));
+	if (resolve_dirs(&(m->dirs), dirs, ndirs))
+		return -1;
+
+	d = pe_manifest_dir_vec_data(&(m->dirs));
+	for (i = 0; i < m->dirs.len; i++)
+		scan_dir(m, d[i].path, prefix, suffix);
+	return 0;
+}
+
+/*
+ * Read the metadata of e without engine_load(), so the engine does not
+ * start and nothing of it is registered. The library is closed again.
+ */
+static int probe(pe_engine_info_t * e)
+{
+	const pe_engine_meta_t *(*meta) ();
+	const pe_engine_meta_t *md;
+	void *handle = pe_dll_open(e->path);
+	int res = -1;
+
+	if (handle == NULL)
+		return -1;
+
+	meta = (const pe_engine_meta_t * (*)())pe_dll_sym(handle,
+							   "engine_meta");
+	if (meta != NULL && (md = meta()) != NULL) {
+		e->name = strdup(md->name != NULL ? md->name : e->key);
+		e->version = strdup(md->version != NULL ? md->version : "");
+		e->suffix = strdup(md->script_suffix != NULL
+				   ? md->script_suffix : "");
+		res = e->name && e->version && e->suffix ? 0 : -1;
+	}
+
+	pe_dll_close(handle);
+	return res;
+}
+
+PE_EXPORT int pe_manifest_probe(pe_manifest_t * m)
+{
+	pe_engine_info_t *e = pe_engine_info_vec_data(&(m->engines));
+	size_t i, n = 0;
+	int changed = 0;
+
+	for (i = 0; i < m->engines.len; i++) {
+		if (e[i].name == NULL) {
+			changed++;
+			if (probe(&(e[i]))) {
+				LOG_WARN("Skipping engine %s, it could not be "
+					 "loaded", e[i].path);
+				info_free(&(e[i]));
+				continue;
+			}
+		}
+		e[n++] = e[i];
+	}
+	m->engines.len = n;
+	return changed;
+}
+
+/* mkdir -p for the parent directories of file */
+static int make_parents(const char *file)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	snprintf(path, sizeof(path), "%s", file);
+	for (p = path + 1; (p = strchr(p, '/')) != NULL; p++) {
+		*p = '\0';
+		if (mkdir(path, 0755) != 0 && pe_errno() != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	return 0;
+}
+
+PE_EXPORT int pe_manifest_save(const pe_manifest_t * m, const char *file)
+{
+	char tmp[PATH_MAX];
+	pe_manifest_dir_t *d;
+	pe_engine_info_t *e;
+	FILE *fp;
+	size_t i;
+
+	if (make_parents(file))
+		return PE_ERROR(pe_errno(), "could not create directory for %s",
+				file);
+
+	/* write a copy and rename it, readers never see half a manifest */
+	snprintf(tmp, sizeof(tmp), "%s.%ld", file, (long)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL)
+		return PE_ERROR(pe_errno(), "could not write %s", tmp);
+
+	fprintf(fp, MANIFEST_MAGIC "\n");
+	d = pe_manifest_dir_vec_data((pe_manifest_dir_vec_t *) & (m->dirs));
+	for (i = 0; i < m->dirs.len; i++)
+		fprintf(fp, "dir\t%lld\t%s\n", (long long)d[i].mtime,
+			d[i].path);
+	e = pe_engine_info_vec_data((pe_engine_info_vec_t *) & (m->engines));
+	for (i = 0; i < m->engines.len; i++)
+		fprintf(fp, "engine\t%lld\t%lld\t%s\t%s\t%s\t%s\t%s\n",
+			(long long)e[i].mtime, (long long)e[i].size,
+			e[i].key, e[i].name ? e[i].name : "",
+			e[i].version ? e[i].version : "",
+			e[i].suffix ? e[i].suffix : "", e[i].path);
+
+	if (fclose(fp) != 0 || rename(tmp, file) != 0) {
+		remove(tmp);
+		return PE_ERROR(pe_errno(), "could not write %s", file);
+	}
+	return 0;
+}
+
+PE_EXPORT const char *pe_manifest_default_file()
+{
+	static char path[PATH_MAX];
+	const char *base = getenv("XDG_CACHE_HOME");
+
+	if (base != NULL && base[0] != '\0')
+		snprintf(path, sizeof(path), "%s/pioe/engines.cache", base);
+	else if ((base = getenv("HOME")) != NULL)
+		snprintf(path, sizeof(path), "%s/.cache/pioe/engines.cache",
+			 base);
+	else
+		return NULL;
+
+	return path;
+}
+#else
+PE_EXPORT int pe_manifest_load(pe_manifest_t * m, const char *file,
+			       const char *dirs[], size_t ndirs)
+{
+	pe_engine_info_vec_init(&(m->engines));
+	pe_manifest_dir_vec_init(&(m->dirs));
+	return -1;
+}
+
+PE_EXPORT int pe_manifest_scan(pe_manifest_t * m, const char *dirs[],
+			       size_t ndirs, const char *prefix,
+			       const char *suffix)
+{
+	pe_engine_info_vec_init(&(m->engines));
+	pe_manifest_dir_vec_init(&(m->dirs));
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+}
+
+PE_EXPORT int pe_manifest_probe(pe_manifest_t * m)
+{
+	return 0;
+}
+
+PE_EXPORT int pe_manifest_save(const pe_manifest_t * m, const char *file)
+{
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+}
+
+PE_EXPORT const char *pe_manifest_default_file()
+{
+	return NULL;
+}
+#endif
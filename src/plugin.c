@@ -21,21 +21,65 @@
  */
 
 #include "pioe/plugin.h"
+#include "pioe/arena.h"
+#include "pioe/pool.h"
 
-static pe_plugin_t *plugins[1024];
-static unsigned int plugins_index = 0;
+static pe_map_t plugins;
+static pe_pool_t params_pool =
+PE_POOL_INIT("params", sizeof(struct parameters));
 
 PE_EXPORT pe_plugin_t *pe_plugin_register(char *name, char *version)
 {
+	if (NULL != pe_map_get(&plugins, name)) {
+		PE_ERROR(-1, "Plugin %s is already registered", name);
+		return NULL;
+	}
+
 	struct pe_plugin *p = malloc(sizeof(struct pe_plugin));
-	p->name = strdup(name);
+	if (NULL == p) {
+		PE_ERROR(-1, "out of memory");
+		return NULL;
+	}
+	p->name = pe_symbol(name);
 	p->version = strdup(version);
-	plugins[plugins_index++] = (pe_plugin_t *) p;
+	pe_map_init(&(p->classes), MAP_STR, 0);
+	if (pe_map_put(&plugins, name, p)) {
+		PE_ERROR(-1, "out of memory");
+		return NULL;
+	}
 
 	LOG_DEBUG("Plugin %s (%s) registered.", name, version);
 	return (pe_plugin_t *) p;
 }
 
+PE_EXPORT pe_plugin_t *pe_plugin_find(const char *name)
+{
+	return pe_map_get(&plugins, name);
+}
+
+PE_EXPORT pe_class_t *pe_plugin_class(pe_plugin_t * p, const char *name)
+{
+	return pe_map_get(&(p->classes), name);
+}
+
+PE_EXPORT struct parameters *pe_plugin_params_new()
+{
+	struct parameters *p = pe_pool_alloc(&params_pool);
+
+	if (NULL == p) {
+		PE_ERROR(-1, "out of memory");
+		return NULL;
+	}
+
+	p->size = 0;
+	return p;
+}
+
+PE_EXPORT void pe_plugin_params_release(pe_param_t * p)
+{
+	pe_pool_release(&params_pool, (void *)p);
+}
+
 PE_EXPORT bool pe_plugin_param(pe_param_t * p, size_t i, void *ptr)
 {
 	if (p->size > i) {
@@ -76,7 +120,11 @@ PE_EXPORT bool pe_plugin_return(pe_param_t * p, void *ptr, pe_parameter_t t)
 		up->i = *((int *)ptr);
 		break;
 	case STRING_T:
-		up->s = strdup(ptr);
+		/* valid until the end of the frame when called from one */
+		if (NULL != pe_arena_current())
+			up->s = pe_arena_strdup(pe_arena_current(), ptr);
+		else
+			up->s = strdup(ptr);
 		break;
 	case FLOAT_T:
 		up->f = *((float *)ptr);
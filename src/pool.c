@@ -0,0 +1,257 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "pioe/pool.h"
+#include "pioe/thread.h"
+#include "pioe/logger.h"
+
+#define ALIGN (sizeof(uint64_t) > sizeof(void *) ? \
+	       sizeof(uint64_t) : sizeof(void *))
+#define ALIGN_UP(n) (((n) + ALIGN - 1) & ~(ALIGN - 1))
+
+/* free objects store the next free object in their first bytes */
+#define NEXT(obj) (*(void **)(obj))
+
+typedef struct pool_cache {
+	pe_pool_t *pool;
+	unsigned int gen;
+	void *head;
+	size_t count;
+} pool_cache_t;
+
+static PE_THREAD_LOCAL pool_cache_t caches[PE_POOL_MAX];
+
+static pe_pool_t *pools[PE_POOL_MAX];
+static unsigned int gens[PE_POOL_MAX];
+static pe_spinlock_t pools_lock = 0;
+
+static size_t object_size(const pe_pool_t * p)
+{
+	return ALIGN_UP(p->size < sizeof(void *) ? sizeof(void *) : p->size);
+}
+
+/* this thread's cache for p, NULL if all slots are taken */
+static pool_cache_t *cache_of(pe_pool_t * p)
+{
+	pool_cache_t *c;
+	int i;
+
+	if (__atomic_load_n(&(p->slot), __ATOMIC_ACQUIRE) < 0) {
+		pe_spin_lock(&pools_lock);
+		for (i = 0; p->slot < 0 && i < PE_POOL_MAX; i++) {
+			if (pools[i] == NULL) {
+				pools[i] = p;
+				p->gen = ++gens[i];
+				__atomic_store_n(&(p->slot), i, __ATOMIC_RELEASE);
+			}
+		}
+		pe_spin_unlock(&pools_lock);
+		if (p->slot < 0)
+			return NULL;
+	}
+
+	c = &(caches[p->slot]);
+	/* the slot belonged to a destroyed pool, its objects are gone */
+	if (c->pool != p || c->gen != p->gen) {
+		c->pool = p;
+		c->gen = p->gen;
+		c->head = NULL;
+		c->count = 0;
+	}
+	return c;
+}
+
+/* add a chunk of objects to the shared list, called with p->lock held */
+static int grow(pe_pool_t * p)
+{
+	size_t size = object_size(p);
+	size_t header = ALIGN_UP(sizeof(void *));
+	char *chunk = malloc(header + PE_POOL_CHUNK * size);
+	char *obj;
+	size_t i;
+
+	if (chunk == NULL)
+		return -1;
+
+	NEXT(chunk) = p->chunks;
+	p->chunks = chunk;
+	for (i = 0; i < PE_POOL_CHUNK; i++) {
+		obj = chunk + header + i * size;
+		NEXT(obj) = p->free;
+		p->free = obj;
+	}
+	p->capacity += PE_POOL_CHUNK;
+	return 0;
+}
+
+/* move up to n objects from the shared list to c, 0 if none left */
+static size_t refill(pe_pool_t * p, pool_cache_t * c, size_t n)
+{
+	void *head, *tail;
+	size_t i;
+
+	pe_spin_lock(&(p->lock));
+	if (p->free == NULL && grow(p)) {
+		pe_spin_unlock(&(p->lock));
+		return 0;
+	}
+
+	head = tail = p->free;
+	for (i = 1; i < n && NEXT(tail) != NULL; i++)
+		tail = NEXT(tail);
+	p->free = NEXT(tail);
+	pe_spin_unlock(&(p->lock));
+
+	NEXT(tail) = c->head;
+	c->head = head;
+	c->count += i;
+	return i;
+}
+
+/* move all but the keep most recently released objects of c back */
+static void spill(pe_pool_t * p, pool_cache_t * c, size_t keep)
+{
+	void *head, *tail, *last = NULL;
+	size_t i;
+
+	if (keep == 0) {
+		head = c->head;
+		c->head = NULL;
+	} else {
+		for (last = c->head, i = 1; i < keep; i++)
+			last = NEXT(last);
+		head = NEXT(last);
+		NEXT(last) = NULL;
+	}
+	for (tail = head; NEXT(tail) != NULL;)
+		tail = NEXT(tail);
+	c->count = keep;
+
+	pe_spin_lock(&(p->lock));
+	NEXT(tail) = p->free;
+	p->free = head;
+	pe_spin_unlock(&(p->lock));
+}
+
+static void count_use(pe_pool_t * p)
+{
+	size_t used = __atomic_add_fetch(&(p->in_use), 1, __ATOMIC_RELAXED);
+	size_t high = __atomic_load_n(&(p->high), __ATOMIC_RELAXED);
+
+	while (used > high
+	       && !__atomic_compare_exchange_n(&(p->high), &high, used, true,
+					       __ATOMIC_RELAXED,
+					       __ATOMIC_RELAXED)) ;
+}
+
+PE_EXPORT void pe_pool_init(pe_pool_t * p, const char *name, size_t size)
+{
+	pe_pool_t init = PE_POOL_INIT(name, size);
+	*p = init;
+}
+
+PE_EXPORT void pe_pool_destroy(pe_pool_t * p)
+{
+	void *chunk, *next;
+
+	pe_spin_lock(&pools_lock);
+	if (p->slot >= 0) {
+		pools[p->slot] = NULL;
+		gens[p->slot]++;
+		p->slot = -1;
+	}
+	pe_spin_unlock(&pools_lock);
+
+	for (chunk = p->chunks; chunk != NULL; chunk = next) {
+		next = NEXT(chunk);
+		free(chunk);
+	}
+	p->chunks = NULL;
+	p->free = NULL;
+	p->capacity = 0;
+	p->in_use = 0;
+}
+
+PE_EXPORT void *pe_pool_alloc(pe_pool_t * p)
+{
+	pool_cache_t *c = cache_of(p);
+	pool_cache_t direct = { p, 0, NULL, 0 };
+	void *obj;
+
+	/* no cache slot left, take objects one by one */
+	if (c == NULL)
+		c = &direct;
+
+	if (c->head == NULL
+	    && refill(p, c, c == &direct ? 1 : PE_POOL_BATCH) == 0)
+		return NULL;
+
+	obj = c->head;
+	c->head = NEXT(obj);
+	c->count--;
+	count_use(p);
+	return obj;
+}
+
+PE_EXPORT void pe_pool_release(pe_pool_t * p, void *obj)
+{
+	pool_cache_t *c = cache_of(p);
+	pool_cache_t direct = { p, 0, NULL, 0 };
+
+	if (obj == NULL)
+		return;
+
+	if (c == NULL)
+		c = &direct;
+
+	NEXT(obj) = c->head;
+	c->head = obj;
+	c->count++;
+	__atomic_sub_fetch(&(p->in_use), 1, __ATOMIC_RELAXED);
+
+	if (c == &direct)
+		spill(p, c, 0);
+	else if (c->count >= 2 * PE_POOL_BATCH)
+		spill(p, c, PE_POOL_BATCH);
+}
+
+PE_EXPORT void pe_pool_stats_dump()
+{
+	pe_pool_t *p;
+	int i;
+
+	pe_spin_lock(&pools_lock);
+	for (i = 0; i < PE_POOL_MAX; i++) {
+		p = pools[i];
+		if (p == NULL)
+			continue;
+		LOG_INFO("Pool %s: %zu bytes per object, %zu allocated, "
+			 "%zu in use, %zu in use at most", p->name,
+			 object_size(p), p->capacity,
+			 __atomic_load_n(&(p->in_use), __ATOMIC_RELAXED),
+			 __atomic_load_n(&(p->high), __ATOMIC_RELAXED));
+	}
+	pe_spin_unlock(&pools_lock);
+}
@@ -21,11 +21,23 @@
  */
 
 #include "pioe/logger.h"
+#include "pioe/binlog.h"
 #include "pioe/util.h"
 #include "pioe/testlib.h"
 #include "pioe/thread.h"
 #include "pioe/error.h"
 #include "pioe/engine.h"
+#include "pioe/queue.h"
+#include "pioe/event.h"
+#include "pioe/timer.h"
+#include "pioe/record.h"
+#include "pioe/arena.h"
+#include "pioe/pool.h"
+#include "pioe/symbol.h"
+#include "pioe/engine/test.h"
+#include <sys/stat.h>
+#include <signal.h>
+#include <unistd.h>
 
 static int list_size = 1024;
 
@@ -91,6 +103,246 @@ static int test_core_logger(pe_testlib_t * t)
 	return 0;
 }
 
+static int test_logger_format(pe_testlib_t * t)
+{
+	pe_logger_t logger;
+	char line[LOGGER_MAX_LEN * 2];
+	char longmsg[LOGGER_MAX_LEN * 2];
+	FILE *fp = tmpfile();
+
+	FAIL_IF(t, fp == NULL);
+
+	TEST_STAGE(t, "unknown variables are rejected");
+	FAIL_IF(t, pe_logger_set_format("%N %Q") == 0);
+	FAIL_IF(t, pe_logger_set_format("%N %") == 0);
+	FAIL_IF(t, strcmp(pe_logger_core()->format, LOGGER_FORMAT_DEFAULT));
+
+	TEST_STAGE(t, "compiled format");
+	FAIL_IF(t, pe_logger_set_format("<%L|%N|%f:%m:%l|100%%|%M|%t>"));
+	pe_logger_new(&logger, "fmt");
+	logger.out = logger.err = fp;
+	pe_logger(logger, LWARNING, "file.c", "func", 42, "%s %i", "msg", 7);
+	rewind(fp);
+	FAIL_IF(t, fgets(line, sizeof(line), fp) == NULL);
+	snprintf(longmsg, sizeof(longmsg),
+		 "<WARN|fmt|file.c:func:42|100%%|msg 7|%u>\n", pe_thread_id());
+	FAIL_IF(t, strcmp(line, longmsg));
+
+	TEST_STAGE(t, "long lines are truncated");
+	memset(longmsg, 'x', sizeof(longmsg) - 1);
+	longmsg[sizeof(longmsg) - 1] = '\0';
+	rewind(fp);
+	pe_logger(logger, LWARNING, "file.c", "func", 42, "%s", longmsg);
+	rewind(fp);
+	FAIL_IF(t, fgets(line, sizeof(line), fp) == NULL);
+	FAIL_IF(t, strlen(line) != LOGGER_MAX_LEN);
+	FAIL_IF(t, line[LOGGER_MAX_LEN - 1] != '\n');
+
+	FAIL_IF(t, pe_logger_set_format(LOGGER_FORMAT_DEFAULT));
+	fclose(fp);
+	return 0;
+}
+
+#define ASYNC_THREADS 4
+#define ASYNC_LINES 1000
+
+static pe_logger_t async_logger;
+
+static void *async_log_worker(void *data)
+{
+	int i;
+
+	for (i = 0; i < ASYNC_LINES; i++)
+		pe_logger(async_logger, LINFO, __FILE__, __func__, __LINE__,
+			  "line %i", i);
+	return NULL;
+}
+
+static int count_lines(FILE * fp)
+{
+	int c, n = 0;
+
+	rewind(fp);
+	while ((c = fgetc(fp)) != EOF)
+		if (c == '\n')
+			n++;
+	return n;
+}
+
+static int test_logger_async(pe_testlib_t * t)
+{
+	pe_thread_t threads[ASYNC_THREADS];
+	FILE *fp = tmpfile();
+	uint64_t dropped;
+	int i;
+
+	FAIL_IF(t, fp == NULL);
+	pe_logger_new(&async_logger, "async");
+	async_logger.out = async_logger.err = fp;
+
+	TEST_STAGE(t, "block");
+	FAIL_IF(t, pe_logger_async_start(16, LOG_OVERFLOW_BLOCK));
+	FAIL_IF(t, pe_logger_async_start(16, LOG_OVERFLOW_BLOCK) == 0);
+	for (i = 0; i < ASYNC_THREADS; i++)
+		FAIL_IF(t, pe_thread_create(&threads[i], async_log_worker,
+					    NULL));
+	for (i = 0; i < ASYNC_THREADS; i++)
+		pe_thread_join(threads[i]);
+	pe_logger_flush();
+	FAIL_IF(t, count_lines(fp) != ASYNC_THREADS * ASYNC_LINES);
+	FAIL_IF(t, pe_logger_dropped() != 0);
+	pe_logger_async_stop();
+
+	TEST_STAGE(t, "drop");
+	FAIL_IF(t, ftruncate(fileno(fp), 0));
+	FAIL_IF(t, pe_logger_async_start(16, LOG_OVERFLOW_DROP));
+	for (i = 0; i < ASYNC_THREADS; i++)
+		FAIL_IF(t, pe_thread_create(&threads[i], async_log_worker,
+					    NULL));
+	for (i = 0; i < ASYNC_THREADS; i++)
+		pe_thread_join(threads[i]);
+	pe_logger_async_stop();
+	dropped = pe_logger_dropped();
+	FAIL_IF(t, count_lines(fp) + dropped != ASYNC_THREADS * ASYNC_LINES);
+
+	TEST_STAGE(t, "synchronous again");
+	async_log_worker(NULL);
+	FAIL_IF(t, count_lines(fp) + dropped !=
+		(ASYNC_THREADS + 1) * ASYNC_LINES);
+
+	fclose(fp);
+	return 0;
+}
+
+static long file_size(FILE * fp)
+{
+	fseek(fp, 0, SEEK_END);
+	return ftell(fp);
+}
+
+static int test_logger_staging(pe_testlib_t * t)
+{
+	pe_logger_t logger;
+	FILE *fp = tmpfile();
+	long size;
+
+	FAIL_IF(t, fp == NULL);
+	pe_logger_new(&logger, "staging");
+	logger.out = logger.err = fp;
+
+	TEST_STAGE(t, "lines are staged");
+	FAIL_IF(t, pe_logger_thread_buffered(true));
+	pe_logger(logger, LINFO, __FILE__, __func__, __LINE__, "one");
+	pe_logger(logger, LWARNING, __FILE__, __func__, __LINE__, "two");
+	FAIL_IF(t, file_size(fp) != 0);
+
+	TEST_STAGE(t, "flush writes the block");
+	pe_logger_thread_flush();
+	size = file_size(fp);
+	FAIL_IF(t, size == 0 || count_lines(fp) != 2);
+
+	TEST_STAGE(t, "errors are written right away");
+	pe_logger(logger, LINFO, __FILE__, __func__, __LINE__, "three");
+	pe_logger(logger, LERROR, __FILE__, __func__, __LINE__, "four");
+	FAIL_IF(t, count_lines(fp) != 4);
+
+	TEST_STAGE(t, "disabling flushes");
+	pe_logger(logger, LINFO, __FILE__, __func__, __LINE__, "five");
+	FAIL_IF(t, pe_logger_thread_buffered(false));
+	FAIL_IF(t, count_lines(fp) != 5);
+	pe_logger(logger, LINFO, __FILE__, __func__, __LINE__, "six");
+	FAIL_IF(t, count_lines(fp) != 6);
+
+	fclose(fp);
+	return 0;
+}
+
+#define BINLOG_FILE "pe_binlog.test"
+
+static void *binlog_worker(void *data)
+{
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		LOG_INFO("thread %p line %i of %s, %.2f%%", data, i, "1000",
+			 i / 10.0);
+	return NULL;
+}
+
+static int test_binlog(pe_testlib_t * t)
+{
+	pe_thread_t threads[4];
+	pe_log_arg_t types[3];
+	const char *p;
+	size_t len;
+	int n, i;
+	FILE *fp;
+	char magic[PE_BINLOG_MAGIC_LEN];
+	long size;
+	/* not terminated, only "%.*s" may read it */
+	struct {
+		char s[3];
+		char tail[5];
+	} unterminated = { {'a', 'b', 'c'}, "XXXX" };
+	/* the length of a stored string, then the string */
+	const unsigned char stored[] = { 3, 0, 'a', 'b', 'c' };
+	unsigned char *data;
+	bool found = false;
+
+	TEST_STAGE(t, "conversions");
+	p = pe_binlog_spec("100%% %-*.*lld!", &len, types, &n);
+	FAIL_IF(t, p == NULL || strncmp(p, "%-*.*lld", len) != 0);
+	FAIL_IF(t, n != 3 || types[0] != LOG_ARG_INT
+		|| types[1] != LOG_ARG_INT || types[2] != LOG_ARG_LLONG);
+	p = pe_binlog_spec("%zu %s %p %c %f", &len, types, &n);
+	FAIL_IF(t, n != 1 || types[0] != LOG_ARG_SIZE);
+	p = pe_binlog_spec(p + len, &len, types, &n);
+	FAIL_IF(t, n != 1 || types[0] != LOG_ARG_STRING);
+	FAIL_IF(t, pe_binlog_spec("%Lf", &len, types, &n) == NULL || n != -1);
+	FAIL_IF(t, pe_binlog_spec("%1$d", &len, types, &n) == NULL || n != -1);
+	FAIL_IF(t, pe_binlog_spec("no %% conversions", &len, types, &n));
+
+	TEST_STAGE(t, "open");
+	FAIL_IF(t, pe_logger_binary_open(BINLOG_FILE));
+	FAIL_IF(t, pe_logger_binary_open(BINLOG_FILE) == 0);
+
+	TEST_STAGE(t, "log from threads");
+	for (i = 0; i < 4; i++)
+		FAIL_IF(t, pe_thread_create(&threads[i], binlog_worker,
+					    &threads[i]));
+	for (i = 0; i < 4; i++)
+		pe_thread_join(threads[i]);
+	LOG_INFO("stored as text: %Lf", (long double)1.5);
+	LOG_INFO("precision: %.*s|", 3, unterminated.s);
+	pe_logger(*pe_logger_core(), LINFO, __FILE__, __func__, __LINE__,
+		  "pe_logger() %s", "too");
+	pe_logger_binary_close();
+
+	TEST_STAGE(t, "file");
+	fp = fopen(BINLOG_FILE, "rb");
+	FAIL_IF(t, fp == NULL);
+	FAIL_IF(t, fread(magic, 1, sizeof(magic), fp) != sizeof(magic));
+	FAIL_IF(t, memcmp(magic, PE_BINLOG_MAGIC, PE_BINLOG_MAGIC_LEN));
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	/* 55 bytes per entry, the text lines are over 100 */
+	FAIL_IF(t, size < 4000 * 55 || size > 4000 * 60);
+
+	TEST_STAGE(t, "precision limits strings");
+	data = malloc(size);
+	FAIL_IF(t, data == NULL);
+	rewind(fp);
+	FAIL_IF(t, fread(data, 1, size, fp) != size);
+	fclose(fp);
+	for (i = 0; !found && i + sizeof(stored) <= size; i++)
+		found = memcmp(data + i, stored, sizeof(stored)) == 0;
+	free(data);
+	FAIL_IF(t, !found);
+
+	remove(BINLOG_FILE);
+	return 0;
+}
+
 static int test_llist(pe_testlib_t * t)
 {
 	TEST_STAGE(t, "define linked list");
@@ -111,7 +363,7 @@ static int test_llist(pe_testlib_t * t)
 	int i = 0;
 	for (i = 0; i < list_size; i++) {
 		LL_PUSH(test_llist, &i);
-		if (LL_EXPAND(test_llist)->value != &i) {
+		if (pe_llist_first(LL_EXPAND(test_llist))->value != &i) {
 			STAGE_FAIL(t, -1);
 			TEST_FAIL(t, -1);
 		}
@@ -132,6 +384,78 @@ static int test_llist(pe_testlib_t * t)
 	}
 	i++;
 	LL_END();
+	FAIL_IF(t, i != list_size);
+
+	TEST_STAGE(t, "append, pop and shift");
+	int first = 1, last = 2;
+	LL_PUSH(test_llist, &first);
+	LL_APPEND(test_llist, &last);
+	FAIL_IF(t, LL_COUNT(test_llist) != list_size + 2);
+	FAIL_IF(t, LL_POP(test_llist, int *) != &last);
+	FAIL_IF(t, LL_SHIFT(test_llist, int *) != &first);
+	FAIL_IF(t, LL_COUNT(test_llist) != list_size);
+
+	TEST_STAGE(t, "drain");
+	while (LL_COUNT(test_llist) > 0)
+		FAIL_IF(t, LL_POP(test_llist, int *) != &i);
+	FAIL_IF(t, pe_llist_pop(LL_EXPAND(test_llist)) != NULL);
+	FAIL_IF(t, pe_llist_shift(LL_EXPAND(test_llist)) != NULL);
+	LL_FREE(test_llist);
+
+	return 0;
+}
+
+typedef struct test_dnode {
+	int value;
+	pe_dlink_t link;
+} test_dnode_t;
+
+static int test_pe_dlist(pe_testlib_t * t)
+{
+	test_dnode_t nodes[8];
+	pe_dlist_t l, other;
+	pe_dlink_t *n;
+	int i;
+
+	TEST_STAGE(t, "append");
+	pe_dlist_init(&l);
+	for (i = 0; i < 8; i++) {
+		nodes[i].value = i;
+		pe_dlist_append(&l, &(nodes[i].link));
+	}
+	FAIL_IF(t, l.count != 8);
+
+	TEST_STAGE(t, "remove from the middle, head and tail");
+	pe_dlist_remove(&l, &(nodes[3].link));
+	pe_dlist_remove(&l, &(nodes[0].link));
+	pe_dlist_remove(&l, &(nodes[7].link));
+	FAIL_IF(t, l.count != 5);
+	i = 0;
+	pe_dlist_each(&l, n) {
+		int v = pe_container_of(n, test_dnode_t, link)->value;
+		FAIL_IF(t, v == 0 || v == 3 || v == 7);
+		i++;
+	}
+	FAIL_IF(t, i != 5);
+
+	TEST_STAGE(t, "push, pop and shift");
+	pe_dlist_push(&l, &(nodes[0].link));
+	FAIL_IF(t, pe_dlist_shift(&l) != &(nodes[0].link));
+	FAIL_IF(t, pe_dlist_pop(&l) != &(nodes[6].link));
+	FAIL_IF(t, l.count != 4);
+
+	TEST_STAGE(t, "concat");
+	pe_dlist_init(&other);
+	pe_dlist_append(&other, &(nodes[7].link));
+	pe_dlist_concat(&l, &other);
+	FAIL_IF(t, !pe_dlist_empty(&other) || l.count != 5);
+	FAIL_IF(t, l.tail != &(nodes[7].link));
+
+	TEST_STAGE(t, "drain");
+	i = 0;
+	while ((n = pe_dlist_shift(&l)) != NULL)
+		i++;
+	FAIL_IF(t, i != 5 || l.count != 0 || l.tail != NULL);
 
 	return 0;
 }
@@ -168,6 +492,46 @@ static int test_pe_sleep(pe_testlib_t * t)
 	return 0;
 }
 
+static int test_pe_clock(pe_testlib_t * t)
+{
+	uint64_t mono, wall, real, deadline;
+
+	TEST_STAGE(t, "enable");
+	pe_clock_set_virtual(true);
+	FAIL_IF(t, !pe_clock_is_virtual());
+	mono = pe_tstamp_mono_usec();
+	wall = pe_tstamp_usec();
+	real = pe_tstamp_mono_real_usec();
+
+	TEST_STAGE(t, "stands still");
+	pe_sleep(20);
+	FAIL_IF(t, pe_tstamp_mono_usec() != mono || pe_tstamp_usec() != wall);
+	FAIL_IF(t, pe_tstamp_mono_real_usec() < real + 20000);
+
+	TEST_STAGE(t, "advance");
+	real = pe_tstamp_mono_real_usec();
+	pe_clock_advance(5000000);
+	FAIL_IF(t, pe_tstamp_mono_usec() != mono + 5000000);
+	FAIL_IF(t, pe_tstamp_usec() != wall + 5000000);
+	FAIL_IF(t, pe_tstamp_mono_real_usec() - real > 1000000);
+
+	TEST_STAGE(t, "sleep_until advances instead of sleeping");
+	deadline = pe_tstamp_mono_usec() + 60000000;
+	real = pe_tstamp_mono_real_usec();
+	pe_sleep_until(deadline);
+	FAIL_IF(t, pe_tstamp_mono_usec() != deadline);
+	FAIL_IF(t, pe_tstamp_mono_real_usec() - real > 1000000);
+
+	TEST_STAGE(t, "disable");
+	pe_clock_set_virtual(false);
+	FAIL_IF(t, pe_clock_is_virtual());
+	real = pe_tstamp_mono_real_usec();
+	mono = pe_tstamp_mono_usec();
+	FAIL_IF(t, mono < real || mono - real > 1000000);
+
+	return 0;
+}
+
 volatile int pe_thread_val = 0;
 static pe_mutex_t mutex;
 
@@ -215,6 +579,620 @@ static int test_pe_thread(pe_testlib_t * t)
 	return 0;
 }
 
+#define QUEUE_ITEMS 1000000
+
+static void *queue_producer(void *args)
+{
+	pe_queue_t *q = args;
+	uint64_t i;
+	for (i = 0; i < QUEUE_ITEMS; i++) {
+		while (pe_queue_push(q, &i))
+			pe_thread_yield();
+	}
+	return NULL;
+}
+
+static int test_pe_queue(pe_testlib_t * t)
+{
+	pe_queue_t *q;
+	uint64_t v, buf[64];
+	int i;
+
+	TEST_STAGE(t, "capacity is rounded up to a power of two");
+	q = pe_queue_new(100, sizeof(uint64_t), PE_QUEUE_SPSC);
+	FAIL_IF(t, q == NULL || pe_queue_capacity(q) != 128);
+
+	TEST_STAGE(t, "pop from empty queue fails");
+	FAIL_IF(t, pe_queue_pop(q, &v) == 0);
+
+	TEST_STAGE(t, "push until full");
+	for (v = 0; v < 128; v++)
+		FAIL_IF(t, pe_queue_push(q, &v) != 0);
+	FAIL_IF(t, pe_queue_push(q, &v) == 0);
+	FAIL_IF(t, pe_queue_count(q) != 128);
+
+	TEST_STAGE(t, "pop keeps order");
+	for (i = 0; i < 100; i++)
+		FAIL_IF(t, pe_queue_pop(q, &v) != 0 || v != i);
+
+	TEST_STAGE(t, "batch pop wraps around");
+	for (v = 128; v < 178; v++)
+		FAIL_IF(t, pe_queue_push(q, &v) != 0);
+	FAIL_IF(t, pe_queue_pop_batch(q, buf, 64) != 64);
+	for (i = 0; i < 64; i++)
+		FAIL_IF(t, buf[i] != 100 + i);
+	FAIL_IF(t, pe_queue_pop_batch(q, buf, 64) != 14);
+	FAIL_IF(t, buf[13] != 177 || pe_queue_count(q) != 0);
+
+	TEST_STAGE(t, "producer and consumer thread");
+	pe_thread_t producer;
+	uint64_t expect = 0;
+	pe_thread_create(&producer, queue_producer, q);
+	while (expect < QUEUE_ITEMS) {
+		size_t n = pe_queue_pop_batch(q, buf, 64);
+		if (n == 0)
+			pe_thread_yield();
+		for (i = 0; i < n; i++)
+			FAIL_IF(t, buf[i] != expect++);
+	}
+	pe_thread_join(producer);
+
+	pe_queue_free(q);
+	return 0;
+}
+
+#define MPMC_PRODUCERS 4
+#define MPMC_CONSUMERS 2
+#define MPMC_STOP UINT64_MAX
+
+struct mpmc_worker {
+	pe_queue_t *q;
+	uint64_t id;
+	uint64_t received;
+	uint64_t sum;
+	int out_of_order;
+};
+
+static void *mpmc_producer(void *args)
+{
+	struct mpmc_worker *w = args;
+	uint64_t i, v;
+	for (i = 0; i < QUEUE_ITEMS / MPMC_PRODUCERS; i++) {
+		v = (w->id << 32) | i;
+		pe_queue_push(w->q, &v);
+	}
+	return NULL;
+}
+
+static void *mpmc_consumer(void *args)
+{
+	struct mpmc_worker *w = args;
+	uint64_t last[MPMC_PRODUCERS] = { 0 };
+	uint64_t v;
+
+	while (pe_queue_pop(w->q, &v) == 0 && v != MPMC_STOP) {
+		uint64_t p = v >> 32, i = v & 0xffffffff;
+		/* every consumer sees each producer's elements in order */
+		if (i != 0 && i <= last[p])
+			w->out_of_order++;
+		last[p] = i;
+		w->received++;
+		w->sum += i;
+	}
+	return NULL;
+}
+
+static int test_pe_queue_mpmc(pe_testlib_t * t)
+{
+	struct mpmc_worker producers[MPMC_PRODUCERS];
+	struct mpmc_worker consumers[MPMC_CONSUMERS];
+	pe_thread_t pt[MPMC_PRODUCERS], ct[MPMC_CONSUMERS];
+	uint64_t v, received = 0, sum = 0, n = QUEUE_ITEMS / MPMC_PRODUCERS;
+	int i, out_of_order = 0;
+	pe_queue_t *q;
+
+	TEST_STAGE(t, "non-blocking queue");
+	q = pe_queue_new(4, sizeof(uint64_t), PE_QUEUE_MPMC);
+	FAIL_IF(t, q == NULL || pe_queue_pop(q, &v) == 0);
+	for (v = 0; v < 4; v++)
+		FAIL_IF(t, pe_queue_push(q, &v) != 0);
+	FAIL_IF(t, pe_queue_push(q, &v) == 0);
+	for (i = 0; i < 4; i++)
+		FAIL_IF(t, pe_queue_pop(q, &v) != 0 || v != i);
+	pe_queue_free(q);
+
+	TEST_STAGE(t, "blocking queue, 4 producers, 2 consumers");
+	q = pe_queue_new(256, sizeof(uint64_t),
+			 PE_QUEUE_MPMC | PE_QUEUE_BLOCKING);
+	for (i = 0; i < MPMC_CONSUMERS; i++) {
+		memset(&consumers[i], 0, sizeof(consumers[i]));
+		consumers[i].q = q;
+		pe_thread_create(&ct[i], mpmc_consumer, &consumers[i]);
+	}
+	for (i = 0; i < MPMC_PRODUCERS; i++) {
+		producers[i].q = q;
+		producers[i].id = i;
+		pe_thread_create(&pt[i], mpmc_producer, &producers[i]);
+	}
+	for (i = 0; i < MPMC_PRODUCERS; i++)
+		pe_thread_join(pt[i]);
+
+	v = MPMC_STOP;
+	for (i = 0; i < MPMC_CONSUMERS; i++)
+		pe_queue_push(q, &v);
+	for (i = 0; i < MPMC_CONSUMERS; i++) {
+		pe_thread_join(ct[i]);
+		received += consumers[i].received;
+		sum += consumers[i].sum;
+		out_of_order += consumers[i].out_of_order;
+	}
+
+	TEST_STAGE(t, "every element received once and in order");
+	FAIL_IF(t, received != QUEUE_ITEMS);
+	FAIL_IF(t, sum != MPMC_PRODUCERS * (n * (n - 1) / 2));
+	FAIL_IF(t, out_of_order != 0);
+
+	pe_queue_free(q);
+	return 0;
+}
+
+static int test_pe_event_coalesce(pe_testlib_t * t)
+{
+	pe_event_coalescer_t c;
+	uint64_t collapsed = 0;
+	size_t n;
+	pe_event_t ev[] = {
+		{1, EVENT_ABS, 0, 10, 1},
+		{1, EVENT_REL, 0, 5, 2},
+		{1, EVENT_KEY, 30, 1, 3},
+		{1, EVENT_ABS, 0, 20, 4},
+		{2, EVENT_ABS, 0, 7, 5},
+		{1, EVENT_REL, 0, -2, 6},
+		{1, EVENT_KEY, 30, 0, 7},
+	};
+
+	TEST_STAGE(t, "init");
+	FAIL_IF(t, pe_event_coalescer_init(&c, 8) != 0);
+
+	TEST_STAGE(t, "merge axis events, keep keys");
+	n = pe_event_coalesce(&c, ev, 7, &collapsed);
+	FAIL_IF(t, n != 5 || collapsed != 2);
+	FAIL_IF(t, ev[0].type != EVENT_ABS || ev[0].value != 20
+		|| ev[0].time != 4);
+	FAIL_IF(t, ev[1].type != EVENT_REL || ev[1].value != 3
+		|| ev[1].time != 6);
+	FAIL_IF(t, ev[2].type != EVENT_KEY || ev[2].value != 1);
+	FAIL_IF(t, ev[3].device != 2 || ev[3].value != 7);
+	FAIL_IF(t, ev[4].type != EVENT_KEY || ev[4].value != 0);
+
+	TEST_STAGE(t, "next batch starts empty");
+	n = pe_event_coalesce(&c, ev, 1, &collapsed);
+	FAIL_IF(t, n != 1 || collapsed != 2 || ev[0].value != 20);
+
+	pe_event_coalescer_free(&c);
+	return 0;
+}
+
+static uint64_t timer_fired[8];
+static int timer_fired_len;
+
+static void timer_record(pe_timer_t * timer)
+{
+	timer_fired[timer_fired_len++] = timer->expires;
+}
+
+static int test_pe_timer(pe_testlib_t * t)
+{
+	pe_timer_wheel_t w;
+	pe_timer_t timers[5];
+	uint64_t next;
+	int i;
+
+	pe_timer_wheel_init(&w, 1000);
+	for (i = 0; i < 5; i++)
+		pe_timer_init(&timers[i], timer_record, NULL);
+
+	TEST_STAGE(t, "empty wheel has no next tick");
+	FAIL_IF(t, pe_timer_wheel_next(&w, &next) == 0);
+
+	TEST_STAGE(t, "schedule on every level");
+	pe_timer_schedule(&w, &timers[0], 1000 + 5000000);
+	pe_timer_schedule(&w, &timers[1], 1000 + 70000);
+	pe_timer_schedule(&w, &timers[2], 1000 + 300);
+	pe_timer_schedule(&w, &timers[3], 1000 + 10);
+	pe_timer_schedule(&w, &timers[4], 1000 + 20);
+	FAIL_IF(t, w.count != 5);
+	FAIL_IF(t, pe_timer_wheel_next(&w, &next) != 0 || next != 1010);
+
+	TEST_STAGE(t, "cancel");
+	FAIL_IF(t, !pe_timer_cancel(&timers[4]));
+	FAIL_IF(t, pe_timer_cancel(&timers[4]));
+	FAIL_IF(t, pe_timer_pending(&timers[4]) || w.count != 4);
+
+	TEST_STAGE(t, "fire only due timers");
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 1009) != 0);
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 1010) != 1);
+	FAIL_IF(t, timer_fired[0] != 1010);
+
+	TEST_STAGE(t, "cascaded timers fire on time and in order");
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 1299) != 0);
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 1300) != 1);
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 70999) != 0);
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 5001000) != 2);
+	FAIL_IF(t, timer_fired_len != 4);
+	FAIL_IF(t, timer_fired[1] != 1300 || timer_fired[2] != 71000
+		|| timer_fired[3] != 5001000);
+	FAIL_IF(t, w.count != 0);
+
+	TEST_STAGE(t, "past expiry fires on the next tick");
+	pe_timer_schedule(&w, &timers[0], 5);
+	FAIL_IF(t, pe_timer_wheel_advance(&w, 5001001) != 1);
+
+	return 0;
+}
+
+#define RECORD_FILE "pe_record.test"
+#define RECORD_EVENTS 10000
+
+static int test_pe_record(pe_testlib_t * t)
+{
+	pe_record_t r;
+	pe_event_t ev = { 1, EVENT_REL, 0, 0, 0 };
+	const pe_record_entry_t *e;
+	uint64_t i;
+
+	TEST_STAGE(t, "create");
+	FAIL_IF(t, pe_record_create(&r, RECORD_FILE, 100) != 0);
+
+	TEST_STAGE(t, "append grows the file");
+	for (i = 0; i < RECORD_EVENTS; i++) {
+		ev.value = i;
+		FAIL_IF(t, pe_record_append(&r, i / 10, &ev) != 0);
+	}
+	FAIL_IF(t, pe_record_close(&r) != 0);
+
+	TEST_STAGE(t, "open");
+	FAIL_IF(t, pe_record_open(&r, RECORD_FILE) != 0);
+	FAIL_IF(t, r.header->count != RECORD_EVENTS);
+	FAIL_IF(t, r.header->frame_rate != 100);
+
+	TEST_STAGE(t, "entries come per frame and in order");
+	FAIL_IF(t, pe_record_next(&r, 0) == NULL);
+	for (i = 1; i < 10; i++)
+		FAIL_IF(t, pe_record_next(&r, 0) == NULL);
+	FAIL_IF(t, pe_record_next(&r, 0) != NULL);
+	for (i = 10; i < RECORD_EVENTS; i++) {
+		e = pe_record_next(&r, RECORD_EVENTS);
+		FAIL_IF(t, e == NULL || e->frame != i / 10
+			|| e->event.value != i);
+	}
+	FAIL_IF(t, !pe_record_eof(&r));
+
+	pe_record_close(&r);
+	remove(RECORD_FILE);
+	return 0;
+}
+
+PE_VEC_DECLARE(test_vec, int, 4)
+
+static int test_pe_vec(pe_testlib_t * t)
+{
+	test_vec_t v;
+	size_t i;
+	int sum = 0;
+
+	TEST_STAGE(t, "inline storage");
+	test_vec_init(&v);
+	for (i = 0; i < 4; i++)
+		FAIL_IF(t, test_vec_push(&v, i) != 0);
+	FAIL_IF(t, v.heap != NULL || test_vec_capacity(&v) != 4);
+
+	TEST_STAGE(t, "geometric growth");
+	for (i = 4; i < 1000; i++)
+		FAIL_IF(t, test_vec_push(&v, i) != 0);
+	FAIL_IF(t, v.heap == NULL || test_vec_capacity(&v) != 1024);
+	for (i = 0; i < 1000; i++)
+		FAIL_IF(t, test_vec_get(&v, i) != i);
+
+	TEST_STAGE(t, "reserve");
+	FAIL_IF(t, test_vec_reserve(&v, 1025) != 0);
+	FAIL_IF(t, test_vec_capacity(&v) != 2048 || v.len != 1000);
+
+	TEST_STAGE(t, "swap remove and pop");
+	FAIL_IF(t, test_vec_swap_remove(&v, 10) != 10);
+	FAIL_IF(t, test_vec_get(&v, 10) != 999 || v.len != 999);
+	FAIL_IF(t, test_vec_pop(&v) != 998 || v.len != 998);
+
+	TEST_STAGE(t, "shrink to fit");
+	test_vec_shrink(&v);
+	FAIL_IF(t, test_vec_capacity(&v) != 998);
+	while (v.len > 3)
+		test_vec_pop(&v);
+	test_vec_shrink(&v);
+	FAIL_IF(t, v.heap != NULL || test_vec_capacity(&v) != 4);
+
+	TEST_STAGE(t, "each");
+	pe_vec_each(test_vec, &v, n, i) {
+		sum += n;
+	}
+	pe_end;
+	FAIL_IF(t, sum != 0 + 1 + 2);
+
+	test_vec_free(&v);
+	FAIL_IF(t, v.len != 0);
+	return 0;
+}
+
+#define MAP_KEYS 10000
+
+static int test_pe_map(pe_testlib_t * t)
+{
+	pe_map_t m, n;
+	char key[32];
+	uintptr_t i;
+	size_t seen = 0;
+
+	TEST_STAGE(t, "string keys");
+	FAIL_IF(t, pe_map_init(&m, MAP_STR, 0) != 0);
+	for (i = 1; i <= MAP_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%lu", (unsigned long)i);
+		FAIL_IF(t, pe_map_put(&m, key, (void *)i) != 0);
+	}
+	FAIL_IF(t, pe_map_count(&m) != MAP_KEYS);
+	for (i = 1; i <= MAP_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%lu", (unsigned long)i);
+		FAIL_IF(t, pe_map_get(&m, key) != (void *)i);
+	}
+	FAIL_IF(t, pe_map_get(&m, "KEY1") != NULL);
+
+	TEST_STAGE(t, "replace");
+	FAIL_IF(t, pe_map_put(&m, "key1", (void *)42) != 0);
+	FAIL_IF(t, pe_map_count(&m) != MAP_KEYS);
+	FAIL_IF(t, pe_map_get(&m, "key1") != (void *)42);
+
+	TEST_STAGE(t, "remove keeps the others reachable");
+	for (i = 2; i <= MAP_KEYS; i += 2) {
+		snprintf(key, sizeof(key), "key%lu", (unsigned long)i);
+		FAIL_IF(t, pe_map_remove(&m, key) != (void *)i);
+	}
+	FAIL_IF(t, pe_map_count(&m) != MAP_KEYS / 2);
+	for (i = 3; i <= MAP_KEYS; i++) {
+		snprintf(key, sizeof(key), "key%lu", (unsigned long)i);
+		FAIL_IF(t, pe_map_get(&m, key) != (i % 2 ? (void *)i : NULL));
+	}
+	FAIL_IF(t, pe_map_remove(&m, "key2") != NULL);
+
+	TEST_STAGE(t, "each");
+	pe_map_each(&m, e, i) {
+		seen++;
+	}
+	pe_end;
+	FAIL_IF(t, seen != MAP_KEYS / 2);
+	pe_map_free(&m);
+
+	TEST_STAGE(t, "case insensitive keys");
+	FAIL_IF(t, pe_map_init(&n, MAP_STR_NOCASE, 4) != 0);
+	FAIL_IF(t, pe_map_put(&n, "Ruby", (void *)1) != 0);
+	FAIL_IF(t, pe_map_get(&n, "rUBY") != (void *)1);
+	pe_map_free(&n);
+
+	TEST_STAGE(t, "integer keys");
+	FAIL_IF(t, pe_map_init(&n, MAP_INT, 0) != 0);
+	for (i = 0; i < MAP_KEYS; i++)
+		FAIL_IF(t, pe_map_put_int(&n, i * 4096, (void *)(i + 1)) != 0);
+	for (i = 0; i < MAP_KEYS; i += 3)
+		FAIL_IF(t, pe_map_remove_int(&n, i * 4096) != (void *)(i + 1));
+	for (i = 0; i < MAP_KEYS; i++)
+		FAIL_IF(t, pe_map_get_int(&n, i * 4096)
+			!= (i % 3 ? (void *)(i + 1) : NULL));
+	pe_map_free(&n);
+
+	return 0;
+}
+
+static int test_pe_arena(pe_testlib_t * t)
+{
+	pe_arena_t a;
+	char *p, *q;
+	int i;
+
+	TEST_STAGE(t, "init");
+	FAIL_IF(t, pe_arena_init(&a, 256) != 0);
+
+	TEST_STAGE(t, "aligned allocations");
+	p = pe_arena_alloc(&a, 3);
+	q = pe_arena_alloc(&a, 8);
+	FAIL_IF(t, p == NULL || q == NULL || q <= p);
+	FAIL_IF(t, ((uintptr_t) q) % sizeof(void *) != 0);
+
+	TEST_STAGE(t, "strdup");
+	p = pe_arena_strdup(&a, "frame");
+	FAIL_IF(t, p == NULL || strcmp(p, "frame") != 0);
+
+	TEST_STAGE(t, "grow past a block");
+	for (i = 0; i < 100; i++)
+		FAIL_IF(t, pe_arena_alloc(&a, 64) == NULL);
+	FAIL_IF(t, pe_arena_alloc(&a, 4096) == NULL);
+
+	TEST_STAGE(t, "reset merges blocks");
+	pe_arena_reset(&a);
+	FAIL_IF(t, a.used != 0 || a.high < 100 * 64 + 4096);
+	p = pe_arena_alloc(&a, 100 * 64);
+	q = pe_arena_alloc(&a, 4096);
+	FAIL_IF(t, q != p + 100 * 64);
+
+	TEST_STAGE(t, "current arena");
+	FAIL_IF(t, pe_arena_current() != NULL);
+	pe_arena_set_current(&a);
+	FAIL_IF(t, pe_arena_current() != &a);
+	pe_arena_set_current(NULL);
+
+	pe_arena_free(&a);
+	return 0;
+}
+
+#define POOL_OBJECTS 1000
+
+static pe_pool_t test_pool = PE_POOL_INIT("test", 24);
+
+static void *pool_worker(void *arg)
+{
+	void *objs[POOL_OBJECTS];
+	int i, round;
+
+	for (round = 0; round < 100; round++) {
+		for (i = 0; i < POOL_OBJECTS; i++) {
+			objs[i] = pe_pool_alloc(&test_pool);
+			if (objs[i] == NULL)
+				return (void *)1;
+			memset(objs[i], 0xab, 24);
+		}
+		for (i = 0; i < POOL_OBJECTS; i++)
+			pe_pool_release(&test_pool, objs[i]);
+	}
+	return NULL;
+}
+
+static int test_pe_pool(pe_testlib_t * t)
+{
+	void *objs[POOL_OBJECTS];
+	pe_thread_t threads[4];
+	int i;
+
+	TEST_STAGE(t, "alloc");
+	for (i = 0; i < POOL_OBJECTS; i++) {
+		objs[i] = pe_pool_alloc(&test_pool);
+		FAIL_IF(t, objs[i] == NULL);
+		FAIL_IF(t, i > 0 && objs[i] == objs[i - 1]);
+	}
+	FAIL_IF(t, test_pool.in_use != POOL_OBJECTS);
+	FAIL_IF(t, test_pool.high != POOL_OBJECTS);
+
+	TEST_STAGE(t, "release and reuse");
+	for (i = 0; i < POOL_OBJECTS; i++)
+		pe_pool_release(&test_pool, objs[i]);
+	FAIL_IF(t, test_pool.in_use != 0);
+	FAIL_IF(t, pe_pool_alloc(&test_pool) != objs[POOL_OBJECTS - 1]);
+	pe_pool_release(&test_pool, objs[POOL_OBJECTS - 1]);
+
+	TEST_STAGE(t, "threads");
+	for (i = 0; i < 4; i++)
+		FAIL_IF(t, pe_thread_create(&threads[i], pool_worker, NULL));
+	for (i = 0; i < 4; i++)
+		pe_thread_join(threads[i]);
+	FAIL_IF(t, test_pool.in_use != 0);
+	FAIL_IF(t, test_pool.high > 5 * POOL_OBJECTS);
+	FAIL_IF(t, test_pool.capacity > 5 * POOL_OBJECTS + 5 * PE_POOL_CHUNK
+		+ 4 * 2 * PE_POOL_BATCH);
+
+	TEST_STAGE(t, "destroy");
+	pe_pool_stats_dump();
+	pe_pool_destroy(&test_pool);
+	FAIL_IF(t, test_pool.capacity != 0);
+	objs[0] = pe_pool_alloc(&test_pool);
+	FAIL_IF(t, objs[0] == NULL);
+	pe_pool_release(&test_pool, objs[0]);
+	pe_pool_destroy(&test_pool);
+
+	return 0;
+}
+
+static int test_pe_symbol(pe_testlib_t * t)
+{
+	char name[16];
+	pe_symbol_t a, b;
+	uint32_t count = pe_symbol_count();
+
+	TEST_STAGE(t, "equal names are equal symbols");
+	strcpy(name, "symbol");
+	a = pe_symbol(name);
+	strcpy(name, "other");
+	b = pe_symbol(name);
+	FAIL_IF(t, a == NULL || b == NULL || a == b);
+	FAIL_IF(t, strcmp(a, "symbol") != 0);
+	FAIL_IF(t, pe_symbol("symbol") != a);
+	FAIL_IF(t, pe_symbol_count() != count + 2);
+
+	TEST_STAGE(t, "find");
+	FAIL_IF(t, pe_symbol_find("other") != b);
+	FAIL_IF(t, pe_symbol_find("never interned") != NULL);
+
+	TEST_STAGE(t, "ids");
+	FAIL_IF(t, pe_symbol_id(b) != pe_symbol_id(a) + 1);
+	FAIL_IF(t, pe_symbol_by_id(pe_symbol_id(a)) != a);
+	FAIL_IF(t, pe_symbol_by_id(0) != NULL);
+	FAIL_IF(t, pe_symbol_by_id(pe_symbol_count() + 1) != NULL);
+
+	TEST_STAGE(t, "logger names are symbols");
+	FAIL_IF(t, pe_logger_core()->name != pe_symbol("core"));
+
+	return 0;
+}
+
+#define MANIFEST_DIR "pe_manifest.test.d"
+#define MANIFEST_FILE "pe_manifest.test"
+
+static int test_pe_manifest(pe_testlib_t * t)
+{
+	const char *dirs[] = { MANIFEST_DIR, "no such directory" };
+	const char *cwd[] = { "./" };
+	pe_manifest_t m;
+	FILE *fp;
+
+	TEST_STAGE(t, "scan");
+	mkdir(MANIFEST_DIR, 0755);
+	fp = fopen(MANIFEST_DIR "/libpioebrokenengine.so", "w");
+	FAIL_IF(t, fp == NULL);
+	fclose(fp);
+	FAIL_IF(t, pe_manifest_scan(&m, dirs, 2, "libpioe", "engine.so"));
+	FAIL_IF(t, m.dirs.len != 1 || m.engines.len != 1);
+	FAIL_IF(t, pe_manifest_find(&m, "broken")->name != NULL);
+
+	TEST_STAGE(t, "probe leaves out what does not load");
+	FAIL_IF(t, pe_manifest_probe(&m) != 1 || m.engines.len != 0);
+	FAIL_IF(t, pe_manifest_probe(&m) != 0);
+
+	TEST_STAGE(t, "save and load");
+	FAIL_IF(t, pe_manifest_save(&m, MANIFEST_FILE));
+	pe_manifest_free(&m);
+	FAIL_IF(t, pe_manifest_load(&m, MANIFEST_FILE, dirs, 2));
+	FAIL_IF(t, m.dirs.len != 1 || pe_manifest_find(&m, "broken"));
+	pe_manifest_free(&m);
+
+	TEST_STAGE(t, "changed directory is stale");
+	remove(MANIFEST_DIR "/libpioebrokenengine.so");
+	FAIL_IF(t, pe_manifest_load(&m, MANIFEST_FILE, dirs, 2) == 0);
+
+	TEST_STAGE(t, "other directories are stale");
+	FAIL_IF(t, pe_manifest_scan(&m, dirs, 2, "libpioe", "engine.so"));
+	FAIL_IF(t, pe_manifest_save(&m, MANIFEST_FILE));
+	pe_manifest_free(&m);
+	FAIL_IF(t, pe_manifest_load(&m, MANIFEST_FILE, dirs, 1));
+	pe_manifest_free(&m);
+	FAIL_IF(t, pe_manifest_load(&m, MANIFEST_FILE, dirs + 1, 1) == 0);
+
+	TEST_STAGE(t, "probe reads the test engine");
+	FAIL_IF(t, pe_manifest_scan(&m, cwd, 1, "libpioe", "engine.so"));
+	FAIL_IF(t, pe_manifest_find(&m, "test") == NULL);
+	pe_manifest_probe(&m);
+	FAIL_IF(t, strcmp(pe_manifest_find(&m, "test")->name, "Test") != 0);
+	FAIL_IF(t, pe_manifest_save(&m, MANIFEST_FILE));
+	pe_manifest_free(&m);
+
+	TEST_STAGE(t, "new files in the current directory are not stale");
+	fp = fopen(MANIFEST_FILE ".new", "w");
+	FAIL_IF(t, fp == NULL);
+	fclose(fp);
+	FAIL_IF(t, pe_manifest_load(&m, MANIFEST_FILE, cwd, 1));
+	FAIL_IF(t, strcmp(pe_manifest_find(&m, "test")->suffix, "pioetest"));
+	pe_manifest_free(&m);
+
+	remove(MANIFEST_FILE ".new");
+	remove(MANIFEST_FILE);
+	rmdir(MANIFEST_DIR);
+	return 0;
+}
+
 static int test_pe_engine(pe_testlib_t * t)
 {
 	TEST_STAGE(t, "load ruby engine");
@@ -223,6 +1201,335 @@ static int test_pe_engine(pe_testlib_t * t)
 	FAIL_IF(t, pe_engine_load_by_name("python") != 0);
 }
 
+#define QUEUE_ENGINE "./libpioetestengine.so"
+#define QUEUE_CAPACITY 4
+#define QUEUE_RECORD "pe_engine_queue.test"
+
+/* load the test engine with a small queue of the given policy */
+static int queue_engine(pe_queue_policy_t policy)
+{
+	if (pe_engine_set_queue(NULL, QUEUE_CAPACITY, policy)
+	    || pe_engine_load(QUEUE_ENGINE))
+		return -1;
+	return pe_engine_init();
+}
+
+/* push events with the values 1..n, returns the number refused */
+static int queue_push(pe_event_type_t type, int n)
+{
+	pe_event_t ev = { 1, type, 0, 0, 0 };
+	int i, refused = 0;
+
+	for (i = 1; i <= n; i++) {
+		ev.value = i;
+		ev.time = 0;
+		if (pe_engine_push_event(&ev))
+			refused++;
+	}
+	return refused;
+}
+
+/* run a single frame in lockstep */
+static int queue_frame(pe_engine_stats_t * s)
+{
+	if (pe_engine_simulate(1) || pe_engine_run())
+		return -1;
+	return pe_engine_stats(pe_testengine(), s);
+}
+
+/* did the frames get exactly these values, in this order */
+static bool queue_seen(const int *values, size_t n)
+{
+	const pe_event_t *ev;
+	size_t i;
+
+	if (pe_testengine_events(&ev) != n)
+		return false;
+	for (i = 0; i < n; i++)
+		if (ev[i].value != values[i])
+			return false;
+	return true;
+}
+
+static int test_pe_engine_simulate(pe_testlib_t * t)
+{
+	pe_engine_stats_t s;
+	uint64_t start;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_DROP_NEWEST));
+	FAIL_IF(t, pe_engine_set_frame_rate(100));
+
+	TEST_STAGE(t, "stops after the simulated frames");
+	FAIL_IF(t, pe_engine_simulate(5));
+	start = pe_tstamp_mono_usec();
+	FAIL_IF(t, pe_engine_run());
+	FAIL_IF(t, pe_engine_frame_id() != 5);
+	FAIL_IF(t, pe_engine_stats(pe_testengine(), &s));
+	FAIL_IF(t, s.frames != 5 || s.skipped != 0);
+
+	TEST_STAGE(t, "the virtual clock moved to the last frame");
+	FAIL_IF(t, !pe_clock_is_virtual());
+	FAIL_IF(t, pe_tstamp_mono_usec() - start != 4 * 10000);
+
+	pe_engine_quit();
+	return 0;
+}
+
+static int test_pe_engine_percentile(pe_testlib_t * t)
+{
+	pe_engine_stats_t s;
+
+	memset(&s, 0, sizeof(s));
+
+	TEST_STAGE(t, "no frames");
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.5) != 0);
+
+	/* 50 frames of 2us, 49 in [8, 10), one in [64, 80) */
+	s.frames = 100;
+	s.histogram[2] = 50;
+	s.histogram[8] = 49;
+	s.histogram[20] = 1;
+	s.max = 70;
+
+	TEST_STAGE(t, "upper bound of the bucket");
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.0) != 2);
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.49) != 2);
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.5) != 9);
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.98) != 9);
+
+	TEST_STAGE(t, "never more than max");
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 0.99) != 70);
+	FAIL_IF(t, pe_engine_stats_percentile(&s, 1.0) != 70);
+
+	return 0;
+}
+
+static int test_pe_engine_rate(pe_testlib_t * t)
+{
+	pe_engine_stats_t s;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_DROP_NEWEST));
+	FAIL_IF(t, pe_engine_set_frame_rate(100));
+	FAIL_IF(t, pe_engine_set_engine_rate("Test", 25));
+	FAIL_IF(t, pe_engine_set_engine_rate("Nope", 25) == 0);
+
+	TEST_STAGE(t, "runs every fourth frame");
+	FAIL_IF(t, pe_engine_simulate(20));
+	FAIL_IF(t, pe_engine_run());
+	FAIL_IF(t, pe_engine_frame_id() != 20);
+	FAIL_IF(t, pe_testengine_frames() != 5);
+	FAIL_IF(t, pe_engine_stats(pe_testengine(), &s));
+	FAIL_IF(t, s.frames != 5 || s.skipped != 0);
+
+	pe_engine_quit();
+	return 0;
+}
+
+/* every frame takes two periods of the virtual clock */
+static int overrun_run(pe_overrun_policy_t policy, uint64_t * elapsed)
+{
+	uint64_t start;
+
+	if (queue_engine(QUEUE_DROP_NEWEST) || pe_engine_set_frame_rate(100))
+		return -1;
+	pe_engine_set_overrun_policy(policy);
+	pe_testengine_set_delay(20);
+	if (pe_engine_simulate(20))
+		return -1;
+
+	start = pe_tstamp_mono_usec();
+	if (pe_engine_run())
+		return -1;
+	*elapsed = pe_tstamp_mono_usec() - start;
+	return 0;
+}
+
+static int test_pe_engine_overrun_drop(pe_testlib_t * t)
+{
+	uint64_t elapsed;
+
+	TEST_STAGE(t, "run");
+	FAIL_IF(t, overrun_run(OVERRUN_DROP, &elapsed));
+
+	TEST_STAGE(t, "every other frame is dropped");
+	FAIL_IF(t, pe_engine_frame_id() != 20);
+	FAIL_IF(t, pe_testengine_frames() != 10);
+
+	TEST_STAGE(t, "the deadlines realign to the clock");
+	FAIL_IF(t, elapsed != 10 * 20000);
+
+	pe_engine_quit();
+	return 0;
+}
+
+static int test_pe_engine_overrun_catchup(pe_testlib_t * t)
+{
+	uint64_t elapsed;
+
+	TEST_STAGE(t, "run");
+	FAIL_IF(t, overrun_run(OVERRUN_CATCHUP, &elapsed));
+
+	TEST_STAGE(t, "every frame runs");
+	FAIL_IF(t, pe_engine_frame_id() != 20);
+	FAIL_IF(t, pe_testengine_frames() != 20);
+
+	TEST_STAGE(t, "the late frames run back to back");
+	FAIL_IF(t, elapsed != 20 * 20000);
+
+	pe_engine_quit();
+	return 0;
+}
+
+#ifdef __linux__
+static void *event_loop(void *arg)
+{
+	*(int *)arg = pe_engine_run();
+	return NULL;
+}
+
+/* wait up to a second for the test engine to see n events */
+static size_t event_wait(size_t n, const pe_event_t ** seen)
+{
+	int i;
+
+	for (i = 0; i < 1000 && pe_testengine_events(seen) < n; i++)
+		pe_sleep(1);
+	return pe_testengine_events(seen);
+}
+
+static int test_pe_engine_event(pe_testlib_t * t)
+{
+	pe_event_t ev = { 1, EVENT_KEY, 0, 0, 0 };
+	const pe_event_t *seen;
+	pe_thread_t loop;
+	int res = -1;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_DROP_NEWEST));
+	FAIL_IF(t, pe_engine_set_run_mode(RUN_EVENT));
+	pe_testengine_set_delay(100);
+	FAIL_IF(t, pe_thread_create(&loop, event_loop, &res));
+
+	TEST_STAGE(t, "an event runs a frame");
+	ev.value = 1;
+	FAIL_IF(t, pe_engine_push_event(&ev));
+	FAIL_IF(t, event_wait(1, &seen) != 1);
+
+	TEST_STAGE(t, "events pushed during a frame get the next one");
+	ev.value = 2;
+	ev.time = 0;
+	FAIL_IF(t, pe_engine_push_event(&ev));
+	FAIL_IF(t, event_wait(2, &seen) != 2 || seen[1].value != 2);
+
+	TEST_STAGE(t, "SIGINT stops the loop");
+	pe_testengine_set_delay(0);
+	raise(SIGINT);
+	pe_thread_join(loop);
+	FAIL_IF(t, res != 0);
+
+	pe_engine_quit();
+	return 0;
+}
+#endif
+
+static int test_pe_engine_drop_newest(pe_testlib_t * t)
+{
+	const int seen[] = { 1, 2, 3, 4 };
+	pe_engine_stats_t s;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_DROP_NEWEST));
+
+	TEST_STAGE(t, "pushes into a full queue fail");
+	FAIL_IF(t, queue_push(EVENT_KEY, 6) != 2);
+
+	TEST_STAGE(t, "the frame gets the oldest events");
+	FAIL_IF(t, queue_frame(&s));
+	FAIL_IF(t, !queue_seen(seen, ARRAY_SIZE(seen)));
+	FAIL_IF(t, s.events != 4 || s.dropped != 2 || s.queue_high != 4);
+
+	pe_engine_quit();
+	return 0;
+}
+
+static int test_pe_engine_drop_oldest(pe_testlib_t * t)
+{
+	const int seen[] = { 3, 4, 5, 6 };
+	pe_engine_stats_t s;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_DROP_OLDEST));
+
+	TEST_STAGE(t, "pushes into a full queue report the drop");
+	FAIL_IF(t, queue_push(EVENT_KEY, 6) != 2);
+
+	TEST_STAGE(t, "the frame gets the newest events");
+	FAIL_IF(t, queue_frame(&s));
+	FAIL_IF(t, !queue_seen(seen, ARRAY_SIZE(seen)));
+	FAIL_IF(t, s.events != 4 || s.dropped != 2 || s.queue_high != 4);
+
+	pe_engine_quit();
+	return 0;
+}
+
+static int test_pe_engine_coalesce(pe_testlib_t * t)
+{
+	/* 5 and 6 go to the overflow table, where 6 replaces 5 */
+	const int seen[] = { 1, 2, 3, 4, 6 };
+	pe_engine_stats_t s;
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_COALESCE));
+	/* only merge in the overflow table, not in the frame */
+	pe_engine_set_coalesce(false);
+
+	TEST_STAGE(t, "axis events overflow without drops");
+	FAIL_IF(t, queue_push(EVENT_ABS, 6) != 0);
+
+	TEST_STAGE(t, "the frame gets queue and overflow");
+	FAIL_IF(t, queue_frame(&s));
+	FAIL_IF(t, !queue_seen(seen, ARRAY_SIZE(seen)));
+	FAIL_IF(t, s.events != 5 || s.coalesced != 1 || s.dropped != 0
+		|| s.queue_high != 5);
+
+	TEST_STAGE(t, "key events are dropped once the overflow is full");
+	FAIL_IF(t, queue_push(EVENT_KEY, 9) != 1);
+	FAIL_IF(t, pe_engine_stats(pe_testengine(), &s) || s.dropped != 1);
+
+	pe_engine_quit();
+	return 0;
+}
+
+static int test_pe_engine_block_replay(pe_testlib_t * t)
+{
+	const int seen[] = { 1, 2, 3, 4 };
+	pe_event_t ev = { 1, EVENT_KEY, 0, 0, 0 };
+	pe_engine_stats_t s;
+	pe_record_t r;
+
+	TEST_STAGE(t, "record more events than the queue holds");
+	FAIL_IF(t, pe_record_create(&r, QUEUE_RECORD, 100));
+	for (ev.value = 1; ev.value <= 6; ev.value++)
+		FAIL_IF(t, pe_record_append(&r, 0, &ev));
+	FAIL_IF(t, pe_record_close(&r));
+
+	TEST_STAGE(t, "load");
+	FAIL_IF(t, queue_engine(QUEUE_BLOCK));
+
+	TEST_STAGE(t, "replay drops instead of blocking");
+	FAIL_IF(t, pe_engine_replay(QUEUE_RECORD, REPLAY_FAST));
+	FAIL_IF(t, pe_engine_run());
+	FAIL_IF(t, pe_engine_stats(pe_testengine(), &s));
+	FAIL_IF(t, !queue_seen(seen, ARRAY_SIZE(seen)));
+	FAIL_IF(t, s.dropped != 2 || s.queue_high != 4);
+
+	pe_engine_quit();
+	remove(QUEUE_RECORD);
+	return 0;
+}
+
 int test_lukrop_joined_project(pe_testlib_t * t)
 {
 	TEST_STAGE(t, "persuade lukrop to join the project");
@@ -239,11 +1546,42 @@ int main(int argc, char *argv[])
 	pe_logger_set_level(LALL);
 
 	pe_testlib_test("logger", &test_core_logger);
+	pe_testlib_test("logger_format", &test_logger_format);
+	pe_testlib_test("logger_staging", &test_logger_staging);
+	pe_testlib_test("logger_async", &test_logger_async);
+	pe_testlib_test("binlog", &test_binlog);
 	pe_testlib_test("error", &test_pe_error);
 	pe_testlib_test("linked_list", &test_llist);
+	pe_testlib_test("pe_dlist", &test_pe_dlist);
 	pe_testlib_test("pe_sleep", &test_pe_sleep);
+	pe_testlib_test("pe_clock", &test_pe_clock);
 	pe_testlib_test("pe_thread", &test_pe_thread);
 	pe_testlib_test("pe_engine", &test_pe_engine);
+	pe_testlib_test("pe_engine_simulate", &test_pe_engine_simulate);
+	pe_testlib_test("pe_engine_percentile", &test_pe_engine_percentile);
+	pe_testlib_test("pe_engine_rate", &test_pe_engine_rate);
+	pe_testlib_test("pe_engine_overrun_drop", &test_pe_engine_overrun_drop);
+	pe_testlib_test("pe_engine_overrun_catchup",
+			&test_pe_engine_overrun_catchup);
+#ifdef __linux__
+	pe_testlib_test("pe_engine_event", &test_pe_engine_event);
+#endif
+	pe_testlib_test("pe_engine_drop_newest", &test_pe_engine_drop_newest);
+	pe_testlib_test("pe_engine_drop_oldest", &test_pe_engine_drop_oldest);
+	pe_testlib_test("pe_engine_coalesce", &test_pe_engine_coalesce);
+	pe_testlib_test("pe_engine_block_replay",
+			&test_pe_engine_block_replay);
+	pe_testlib_test("pe_queue", &test_pe_queue);
+	pe_testlib_test("pe_queue_mpmc", &test_pe_queue_mpmc);
+	pe_testlib_test("pe_event_coalesce", &test_pe_event_coalesce);
+	pe_testlib_test("pe_timer", &test_pe_timer);
+	pe_testlib_test("pe_record", &test_pe_record);
+	pe_testlib_test("pe_vec", &test_pe_vec);
+	pe_testlib_test("pe_map", &test_pe_map);
+	pe_testlib_test("pe_arena", &test_pe_arena);
+	pe_testlib_test("pe_pool", &test_pe_pool);
+	pe_testlib_test("pe_symbol", &test_pe_symbol);
+	pe_testlib_test("pe_manifest", &test_pe_manifest);
 	pe_testlib_test("lukrop", &test_lukrop_joined_project);
 
 	int i;
@@ -23,6 +23,367 @@
 #include "pioe/queue.h"
 #include "pioe/error.h"
 #include "pioe/logger.h"
-#include "pioe/thread.h"
 
-static pe_mutex_t mutex;
+#include <string.h>
+#include <stdint.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#define LOAD(p, order) __atomic_load_n(p, __ATOMIC_##order)
+#define STORE(p, v, order) __atomic_store_n(p, v, __ATOMIC_##order)
+#define CAS(p, old, new) \
+	__atomic_compare_exchange_n(p, old, new, 1, __ATOMIC_RELAXED, \
+				    __ATOMIC_RELAXED)
+
+#define SLOT(q, i) ((q)->buf + ((i) & (q)->mask) * (q)->slot_size)
+
+/* MPMC slots start with their sequence number, followed by the element */
+#define SEQ(slot) ((size_t *)(slot))
+#define DATA(slot) ((slot) + sizeof(size_t))
+
+/* how often a blocking call retries before it goes to sleep */
+#define QUEUE_SPIN 64
+
+static void *aligned_malloc(size_t size)
+{
+	void *p = NULL;
+#ifdef _WIN32
+	p = _aligned_malloc(size, PE_CACHELINE);
+#else
+	if (posix_memalign(&p, PE_CACHELINE, size))
+		p = NULL;
+#endif
+	return p;
+}
+
+static void aligned_free(void *p)
+{
+#ifdef _WIN32
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+PE_EXPORT pe_queue_t *pe_queue_new(size_t capacity, size_t elem_size,
+				   int flags)
+{
+	size_t size = 1;
+	size_t i;
+
+	if (capacity == 0 || elem_size == 0) {
+		PE_ERROR(-1, "invalid queue size %zu x %zu", capacity,
+			 elem_size);
+		return NULL;
+	}
+
+	while (size < capacity)
+		size <<= 1;
+
+	pe_queue_t *q = aligned_malloc(sizeof(pe_queue_t));
+	if (NULL == q) {
+		PE_ERROR(-1, "out of memory");
+		return NULL;
+	}
+
+	q->flags = flags;
+	q->elem_size = elem_size;
+	q->slot_size = elem_size;
+	if (flags & PE_QUEUE_MPMC) {
+		/* keep the sequence numbers aligned */
+		q->slot_size = sizeof(size_t) +
+		    (elem_size + sizeof(size_t) - 1) / sizeof(size_t) *
+		    sizeof(size_t);
+	}
+
+	q->buf = aligned_malloc(size * q->slot_size);
+	if (NULL == q->buf) {
+		aligned_free(q);
+		PE_ERROR(-1, "out of memory");
+		return NULL;
+	}
+
+	q->head = q->tail_cache = 0;
+	q->tail = q->head_cache = 0;
+	q->mask = size - 1;
+
+	if (flags & PE_QUEUE_MPMC) {
+		for (i = 0; i < size; i++)
+			*SEQ(SLOT(q, i)) = i;
+	}
+
+	q->push_waiters = q->pop_waiters = 0;
+	if (flags & PE_QUEUE_BLOCKING) {
+		pe_mutex_init(&q->wait_mutex);
+		pe_cond_init(&q->not_full);
+		pe_cond_init(&q->not_empty);
+	}
+
+	return q;
+}
+
+PE_EXPORT void pe_queue_free(pe_queue_t * q)
+{
+	if (NULL == q)
+		return;
+
+	aligned_free(q->buf);
+	aligned_free(q);
+}
+
+/*
+ * SPSC: head and tail are free running counters, the slot index is
+ * counter & mask. Each side only writes its own counter and keeps a
+ * cached copy of the other one, so the shared cache line is only read
+ * when the cached value says the queue is full (producer) or empty
+ * (consumer).
+ */
+static int spsc_push(pe_queue_t * q, const void *elem)
+{
+	size_t tail = LOAD(&q->tail, RELAXED);
+
+	if (tail - q->head_cache > q->mask) {
+		q->head_cache = LOAD(&q->head, ACQUIRE);
+		if (tail - q->head_cache > q->mask)
+			return -1;
+	}
+
+	memcpy(SLOT(q, tail), elem, q->elem_size);
+	STORE(&q->tail, tail + 1, RELEASE);
+
+	return 0;
+}
+
+static size_t spsc_pop(pe_queue_t * q, void *elems, size_t max)
+{
+	size_t head = LOAD(&q->head, RELAXED);
+	size_t avail = q->tail_cache - head;
+
+	if (avail < max) {
+		q->tail_cache = LOAD(&q->tail, ACQUIRE);
+		avail = q->tail_cache - head;
+	}
+
+	size_t n = avail < max ? avail : max;
+	if (n == 0)
+		return 0;
+
+	/* copy in at most two runs, the second one after wrapping around */
+	size_t first = q->mask + 1 - (head & q->mask);
+	if (first > n)
+		first = n;
+
+	memcpy(elems, SLOT(q, head), first * q->elem_size);
+	memcpy((unsigned char *)elems + first * q->elem_size, q->buf,
+	       (n - first) * q->elem_size);
+
+	STORE(&q->head, head + n, RELEASE);
+
+	return n;
+}
+
+/*
+ * MPMC: a slot is free for the producer claiming position pos when its
+ * sequence is pos, and holds an element for the consumer claiming pos
+ * when its sequence is pos + 1. Claiming a position is a CAS on tail
+ * (producers) or head (consumers); after copying, the sequence is
+ * advanced to hand the slot over to the other side.
+ */
+static int mpmc_push(pe_queue_t * q, const void *elem)
+{
+	size_t pos = LOAD(&q->tail, RELAXED);
+	unsigned char *slot;
+
+	for (;;) {
+		slot = SLOT(q, pos);
+		size_t seq = LOAD(SEQ(slot), ACQUIRE);
+		intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+		if (diff == 0) {
+			if (CAS(&q->tail, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = LOAD(&q->tail, RELAXED);
+		}
+	}
+
+	memcpy(DATA(slot), elem, q->elem_size);
+	STORE(SEQ(slot), pos + 1, RELEASE);
+
+	return 0;
+}
+
+static int mpmc_pop_one(pe_queue_t * q, void *elem)
+{
+	size_t pos = LOAD(&q->head, RELAXED);
+	unsigned char *slot;
+
+	for (;;) {
+		slot = SLOT(q, pos);
+		size_t seq = LOAD(SEQ(slot), ACQUIRE);
+		intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+		if (diff == 0) {
+			if (CAS(&q->head, &pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return -1;
+		} else {
+			pos = LOAD(&q->head, RELAXED);
+		}
+	}
+
+	memcpy(elem, DATA(slot), q->elem_size);
+	STORE(SEQ(slot), pos + q->mask + 1, RELEASE);
+
+	return 0;
+}
+
+static size_t mpmc_pop(pe_queue_t * q, void *elems, size_t max)
+{
+	size_t n;
+	unsigned char *p = elems;
+
+	for (n = 0; n < max; n++, p += q->elem_size) {
+		if (mpmc_pop_one(q, p))
+			break;
+	}
+
+	return n;
+}
+
+static int try_push(pe_queue_t * q, const void *elem)
+{
+	if (q->flags & PE_QUEUE_MPMC)
+		return mpmc_push(q, elem);
+	return spsc_push(q, elem);
+}
+
+static size_t try_pop(pe_queue_t * q, void *elems, size_t max)
+{
+	if (q->flags & PE_QUEUE_MPMC)
+		return mpmc_pop(q, elems, max);
+	return spsc_pop(q, elems, max);
+}
+
+/*
+ * Sleeping threads register in *waiters before their last retry, and the
+ * other side checks *waiters after publishing. The full fences make sure
+ * that at least one of both sees the other, so no wakeup gets lost.
+ */
+static void wake(pe_queue_t * q, int *waiters, pe_cond_t * c)
+{
+	if (!(q->flags & PE_QUEUE_BLOCKING))
+		return;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (LOAD(waiters, RELAXED) == 0)
+		return;
+
+	pe_mutex_lock(&q->wait_mutex);
+	pe_cond_broadcast(c);
+	pe_mutex_unlock(&q->wait_mutex);
+}
+
+PE_EXPORT int pe_queue_push(pe_queue_t * q, const void *elem)
+{
+	int i;
+
+	if (try_push(q, elem) == 0)
+		goto pushed;
+
+	if (!(q->flags & PE_QUEUE_BLOCKING))
+		return -1;
+
+	for (i = 0; i < QUEUE_SPIN; i++) {
+		pe_thread_yield();
+		if (try_push(q, elem) == 0)
+			goto pushed;
+	}
+
+	pe_mutex_lock(&q->wait_mutex);
+	__atomic_add_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while (try_push(q, elem))
+		pe_cond_wait(&q->not_full, &q->wait_mutex);
+	__atomic_sub_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+	pe_mutex_unlock(&q->wait_mutex);
+
+ pushed:
+	wake(q, &q->pop_waiters, &q->not_empty);
+	return 0;
+}
+
+PE_EXPORT int pe_queue_try_push(pe_queue_t * q, const void *elem)
+{
+	if (try_push(q, elem))
+		return -1;
+
+	wake(q, &q->pop_waiters, &q->not_empty);
+	return 0;
+}
+
+PE_EXPORT int pe_queue_pop(pe_queue_t * q, void *elem)
+{
+	return pe_queue_pop_batch(q, elem, 1) == 1 ? 0 : -1;
+}
+
+PE_EXPORT size_t pe_queue_pop_batch(pe_queue_t * q, void *elems, size_t max)
+{
+	size_t n;
+	int i;
+
+	if (max == 0)
+		return 0;
+
+	if ((n = try_pop(q, elems, max)) > 0)
+		goto popped;
+
+	if (!(q->flags & PE_QUEUE_BLOCKING))
+		return 0;
+
+	for (i = 0; i < QUEUE_SPIN; i++) {
+		pe_thread_yield();
+		if ((n = try_pop(q, elems, max)) > 0)
+			goto popped;
+	}
+
+	pe_mutex_lock(&q->wait_mutex);
+	__atomic_add_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	while ((n = try_pop(q, elems, max)) == 0)
+		pe_cond_wait(&q->not_empty, &q->wait_mutex);
+	__atomic_sub_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+	pe_mutex_unlock(&q->wait_mutex);
+
+ popped:
+	wake(q, &q->push_waiters, &q->not_full);
+	return n;
+}
+
+PE_EXPORT size_t pe_queue_try_pop_batch(pe_queue_t * q, void *elems,
+					size_t max)
+{
+	size_t n = try_pop(q, elems, max);
+
+	if (n > 0)
+		wake(q, &q->push_waiters, &q->not_full);
+	return n;
+}
+
+PE_EXPORT size_t pe_queue_count(pe_queue_t * q)
+{
+	size_t head = LOAD(&q->head, ACQUIRE);
+	size_t tail = LOAD(&q->tail, ACQUIRE);
+
+	/* MPMC producers may have claimed positions a consumer is ahead of */
+	return tail > head ? tail - head : 0;
+}
+
+PE_EXPORT size_t pe_queue_capacity(pe_queue_t * q)
+{
+	return q->mask + 1;
+}
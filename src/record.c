@@ -0,0 +1,202 @@
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include "pioe/record.h"
+#include "pioe/error.h"
+#include "pioe/logger.h"
+
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* grow the file by this many entries at least */
+#define RECORD_GROW 4096
+
+#define ENTRIES_SIZE(n) (sizeof(pe_record_header_t) + \
+			 (n) * sizeof(pe_record_entry_t))
+
+#ifndef _WIN32
+static int record_map(pe_record_t * r, size_t size)
+{
+	int prot = PROT_READ | (r->writable ? PROT_WRITE : 0);
+	void *map = mmap(NULL, size, prot, MAP_SHARED, r->fd, 0);
+
+	if (map == MAP_FAILED)
+		return PE_ERROR(pe_errno(), "could not map recording: %s",
+				pe_error_str(pe_errno()));
+
+	r->header = map;
+	r->entries = (pe_record_entry_t *) (r->header + 1);
+	r->size = size;
+	return 0;
+}
+
+static int record_grow(pe_record_t * r)
+{
+	size_t size = r->size * 2;
+
+	if (size < ENTRIES_SIZE(RECORD_GROW))
+		size = ENTRIES_SIZE(RECORD_GROW);
+
+	if (ftruncate(r->fd, size))
+		return PE_ERROR(pe_errno(), "could not grow recording: %s",
+				pe_error_str(pe_errno()));
+
+	munmap(r->header, r->size);
+	return record_map(r, size);
+}
+#endif
+
+PE_EXPORT int pe_record_create(pe_record_t * r, const char *path,
+			       unsigned int frame_rate)
+{
+#ifdef _WIN32
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+#else
+	memset(r, 0, sizeof(pe_record_t));
+	r->writable = true;
+	r->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (r->fd < 0)
+		return PE_ERROR(pe_errno(), "%s: %s", path,
+				pe_error_str(pe_errno()));
+
+	if (ftruncate(r->fd, ENTRIES_SIZE(RECORD_GROW))
+	    || record_map(r, ENTRIES_SIZE(RECORD_GROW))) {
+		close(r->fd);
+		return PE_ERROR(pe_errno(), "could not create %s", path);
+	}
+
+	memcpy(r->header->magic, PE_RECORD_MAGIC, sizeof(r->header->magic));
+	r->header->version = PE_RECORD_VERSION;
+	r->header->frame_rate = frame_rate;
+	r->header->count = 0;
+	pe_mutex_init(&(r->mutex));
+
+	return 0;
+#endif
+}
+
+PE_EXPORT int pe_record_open(pe_record_t * r, const char *path)
+{
+#ifdef _WIN32
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+#else
+	struct stat st;
+
+	memset(r, 0, sizeof(pe_record_t));
+	r->fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (r->fd < 0)
+		return PE_ERROR(pe_errno(), "%s: %s", path,
+				pe_error_str(pe_errno()));
+
+	if (fstat(r->fd, &st) || (size_t)st.st_size < ENTRIES_SIZE(0)) {
+		close(r->fd);
+		return PE_ERROR(-1, "%s is not a recording", path);
+	}
+
+	if (record_map(r, st.st_size)) {
+		close(r->fd);
+		return -1;
+	}
+
+	if (memcmp(r->header->magic, PE_RECORD_MAGIC,
+		   sizeof(r->header->magic)) != 0
+	    || r->header->version != PE_RECORD_VERSION
+	    || ENTRIES_SIZE(r->header->count) > r->size) {
+		pe_record_close(r);
+		return PE_ERROR(-1, "%s is not a recording of version %i",
+				path, PE_RECORD_VERSION);
+	}
+
+	pe_mutex_init(&(r->mutex));
+	return 0;
+#endif
+}
+
+PE_EXPORT int pe_record_append(pe_record_t * r, uint64_t frame,
+			       const pe_event_t * ev)
+{
+#ifdef _WIN32
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+#else
+	int res = 0;
+
+	pe_mutex_lock(&(r->mutex));
+	if (ENTRIES_SIZE(r->header->count + 1) > r->size)
+		res = record_grow(r);
+
+	if (res == 0) {
+		pe_record_entry_t *e = &(r->entries[r->header->count]);
+		e->frame = frame;
+		e->event = *ev;
+		/* count the entry only once it is complete */
+		__atomic_store_n(&(r->header->count), r->header->count + 1,
+				 __ATOMIC_RELEASE);
+	}
+	pe_mutex_unlock(&(r->mutex));
+
+	return res;
+#endif
+}
+
+PE_EXPORT const pe_record_entry_t *pe_record_next(pe_record_t * r,
+						  uint64_t frame)
+{
+	if (pe_record_eof(r) || r->entries[r->pos].frame > frame)
+		return NULL;
+
+	return &(r->entries[r->pos++]);
+}
+
+PE_EXPORT bool pe_record_eof(const pe_record_t * r)
+{
+	return r->header == NULL || r->pos >= r->header->count;
+}
+
+PE_EXPORT int pe_record_close(pe_record_t * r)
+{
+#ifdef _WIN32
+	return PE_ERROR(-1, "NOT IMPLEMENTED");
+#else
+	size_t used;
+
+	if (r->header == NULL)
+		return 0;
+
+	used = ENTRIES_SIZE(r->header->count);
+	munmap(r->header, r->size);
+	r->header = NULL;
+	r->entries = NULL;
+
+	if (r->writable && ftruncate(r->fd, used))
+		LOG_WARN("could not trim recording: %s",
+			 pe_error_str(pe_errno()));
+
+	close(r->fd);
+	r->fd = -1;
+	return 0;
+#endif
+}
@@ -0,0 +1,113 @@
+
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pioe/symbol.h"
+#include "pioe/thread.h"
+#include "pioe/util.h"
+
+typedef struct symbol {
+	uint32_t id;
+	char name[];
+} symbol_t;
+
+PE_VEC_DECLARE(symbol_vec, symbol_t *, 64)
+
+static pe_map_t table;		/* name -> symbol_t */
+static symbol_vec_t by_id;	/* id - 1 -> symbol_t */
+static pe_spinlock_t lock = 0;
+
+PE_EXPORT pe_symbol_t pe_symbol(const char *name)
+{
+	symbol_t *s;
+	size_t len;
+
+	pe_spin_lock(&lock);
+	s = pe_map_get(&table, name);
+	if (s != NULL) {
+		pe_spin_unlock(&lock);
+		return s->name;
+	}
+
+	len = strlen(name) + 1;
+	s = malloc(sizeof(symbol_t) + len);
+	if (s == NULL)
+		goto fail;
+	memcpy(s->name, name, len);
+	s->id = by_id.len + 1;
+
+	if (symbol_vec_push(&by_id, s))
+		goto fail;
+	if (pe_map_put(&table, name, s)) {
+		symbol_vec_pop(&by_id);
+		goto fail;
+	}
+
+	pe_spin_unlock(&lock);
+	return s->name;
+
+ fail:
+	pe_spin_unlock(&lock);
+	free(s);
+	return NULL;
+}
+
+PE_EXPORT pe_symbol_t pe_symbol_find(const char *name)
+{
+	symbol_t *s;
+
+	pe_spin_lock(&lock);
+	s = pe_map_get(&table, name);
+	pe_spin_unlock(&lock);
+
+	return s != NULL ? s->name : NULL;
+}
+
+PE_EXPORT uint32_t pe_symbol_id(pe_symbol_t s)
+{
+	return pe_container_of(s, symbol_t, name)->id;
+}
+
+PE_EXPORT pe_symbol_t pe_symbol_by_id(uint32_t id)
+{
+	pe_symbol_t s = NULL;
+
+	pe_spin_lock(&lock);
+	if (id > 0 && id <= by_id.len)
+		s = symbol_vec_get(&by_id, id - 1)->name;
+	pe_spin_unlock(&lock);
+
+	return s;
+}
+
+PE_EXPORT uint32_t pe_symbol_count()
+{
+	uint32_t n;
+
+	pe_spin_lock(&lock);
+	n = by_id.len;
+	pe_spin_unlock(&lock);
+
+	return n;
+}
@@ -22,6 +22,7 @@
 
 #include "pioe/testlib.h"
 #include "pioe/export.h"
+#include "pioe/util.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdint.h>
@@ -30,8 +31,7 @@
 #include <sys/time.h>
 #include <stdarg.h>
 
-static pe_testlib_t *tests[1024];
-static int tests_count = 0;
+static pe_map_t tests;
 static uint64_t usec();
 
 static uint64_t usec()
@@ -48,8 +48,7 @@ PE_EXPORT int pe_testlib_test(char *name, int (*testfunc) (pe_testlib_t * t))
 	t->func = testfunc;
 	t->stages_i = 0;
 	t->current = NULL;
-	tests[tests_count++] = t;
-	return 0;
+	return pe_map_put(&tests, name, t);
 }
 
 PE_EXPORT int pe_testlib_stage(pe_testlib_t * t, char *name)
@@ -80,14 +79,7 @@ PE_EXPORT int pe_testlib_runtests(char *keys[], size_t size)
 
 PE_EXPORT int pe_testlib_runtest(char *key)
 {
-	int i;
-	pe_testlib_t *t = NULL;
-	for (i = 0; i < tests_count; i++) {
-		if (strcmp(tests[i]->name, key) == 0) {
-			t = tests[i];
-			break;
-		}
-	}
+	pe_testlib_t *t = pe_map_get(&tests, key);
 
 	if (NULL == t) {
 		fprintf(stderr, "Test %s not found\n", key);
@@ -23,7 +23,9 @@
 #include "pioe/thread.h"
 #include "pioe/util.h"
 
-static pe_list_t *threads = NULL;
+#ifndef _WIN32
+#include <sched.h>
+#endif
 
 PE_EXPORT int pe_mutex_lock(pe_mutex_t * m)
 {
@@ -59,6 +61,52 @@ PE_EXPORT int pe_mutex_init(pe_mutex_t * m)
 	return res;
 }
 
+PE_EXPORT int pe_cond_init(pe_cond_t * c)
+{
+	int res = 0;
+#if defined(_WIN32)
+	*c = CreateEvent(NULL, FALSE, FALSE, NULL);
+	res = *c == NULL ? -1 : 0;
+#else
+	res = pthread_cond_init(c, NULL);
+#endif
+	return res;
+}
+
+PE_EXPORT int pe_cond_wait(pe_cond_t * c, pe_mutex_t * m)
+{
+	int res = 0;
+#if defined(_WIN32)
+	res = SignalObjectAndWait(*m, *c, INFINITE, FALSE);
+	WaitForSingleObject(*m, INFINITE);
+#else
+	res = pthread_cond_wait(c, m);
+#endif
+	return res;
+}
+
+PE_EXPORT int pe_cond_signal(pe_cond_t * c)
+{
+	int res = 0;
+#if defined(_WIN32)
+	res = SetEvent(*c) ? 0 : -1;
+#else
+	res = pthread_cond_signal(c);
+#endif
+	return res;
+}
+
+PE_EXPORT int pe_cond_broadcast(pe_cond_t * c)
+{
+	int res = 0;
+#if defined(_WIN32)
+	res = SetEvent(*c) ? 0 : -1;
+#else
+	res = pthread_cond_broadcast(c);
+#endif
+	return res;
+}
+
 PE_EXPORT int pe_thread_create(pe_thread_t * t, void *func(void *), void *data)
 {
 	int res = 0;
@@ -103,3 +151,23 @@ PE_EXPORT int pe_thread_cancel(pe_thread_t t)
 #endif
 
 }
+
+static unsigned int thread_ids;
+static PE_THREAD_LOCAL unsigned int thread_id;
+
+PE_EXPORT unsigned int pe_thread_id()
+{
+	if (thread_id == 0)
+		thread_id = __atomic_add_fetch(&thread_ids, 1,
+					       __ATOMIC_RELAXED);
+	return thread_id;
+}
+
+PE_EXPORT void pe_thread_yield()
+{
+#if defined(_WIN32)
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
@@ -0,0 +1,168 @@
+/*
+ * this file is part of pioe
+ * 
+ * Copyright (C) 2016-2017 Konrad Lother <k@hiddenbox.org>                            
+ *                                                                               
+ * This program is free software; you can redistribute it and/or                
+ * modify it under the terms of the GNU General Public License                  
+ * version 2, as published by the Free Software Foundation.                     
+ *                                                                              
+ * This program is distributed in the hope that it will be useful, but          
+ * WITHOUT ANY WARRANTY; without even the implied warranty of                   
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU             
+ * General Public License version 2 for more details.                           
+ *                                                                              
+ * You should have received a copy of the GNU General Public License            
+ * version 2 along with this program; if not, write to the Free                 
+ * Software Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,          
+ * MA 02110-1301, USA.     
+ *
+ */
+
+#include "pioe/timer.h"
+
+#define SLOT_MASK (PE_TIMER_SLOTS - 1)
+#define LEVEL_SHIFT(l) ((l) * PE_TIMER_BITS)
+#define SLOT(tick, l) (((tick) >> LEVEL_SHIFT(l)) & SLOT_MASK)
+
+#define TIMER(n) pe_container_of(n, pe_timer_t, link)
+
+/* pick the level by the distance to now, the slot by the expiry */
+static void place(pe_timer_wheel_t * w, pe_timer_t * t)
+{
+	uint64_t delta = t->expires - w->now;
+	uint64_t expires = t->expires;
+	int level;
+
+	for (level = 0; level < PE_TIMER_LEVELS - 1; level++)
+		if (delta < (1ULL << LEVEL_SHIFT(level + 1)))
+			break;
+
+	/* too far out, park it at the end of the range and cascade again */
+	if (delta >= (1ULL << LEVEL_SHIFT(PE_TIMER_LEVELS)))
+		expires = w->now + (1ULL << LEVEL_SHIFT(PE_TIMER_LEVELS)) - 1;
+
+	t->slot = &(w->slots[level][SLOT(expires, level)]);
+	pe_dlist_append(t->slot, &(t->link));
+}
+
+static void cascade(pe_timer_wheel_t * w, int level)
+{
+	pe_dlist_t list;
+	pe_dlink_t *n;
+
+	if (level >= PE_TIMER_LEVELS)
+		return;
+
+	/* the level above wraps around as well */
+	if (SLOT(w->now, level) == 0)
+		cascade(w, level + 1);
+
+	pe_dlist_init(&list);
+	pe_dlist_concat(&list, &(w->slots[level][SLOT(w->now, level)]));
+	while ((n = pe_dlist_shift(&list)) != NULL)
+		place(w, TIMER(n));
+}
+
+PE_EXPORT void pe_timer_wheel_init(pe_timer_wheel_t * w, uint64_t now)
+{
+	int l, s;
+
+	w->now = now;
+	w->count = 0;
+	for (l = 0; l < PE_TIMER_LEVELS; l++)
+		for (s = 0; s < PE_TIMER_SLOTS; s++)
+			pe_dlist_init(&(w->slots[l][s]));
+}
+
+PE_EXPORT size_t pe_timer_wheel_advance(pe_timer_wheel_t * w, uint64_t now)
+{
+	pe_dlist_t *due;
+	pe_dlink_t *n;
+	pe_timer_t *t;
+	size_t fired = 0;
+
+	while (w->now < now) {
+		/* nothing to cascade or fire, jump ahead */
+		if (w->count == 0) {
+			w->now = now;
+			break;
+		}
+
+		w->now++;
+		if (SLOT(w->now, 0) == 0)
+			cascade(w, 1);
+
+		/*
+		 * callbacks may cancel other due timers, so take them from the
+		 * slot one at a time; new timers never land in the current slot
+		 */
+		due = &(w->slots[0][SLOT(w->now, 0)]);
+		while ((n = pe_dlist_shift(due)) != NULL) {
+			t = TIMER(n);
+			t->slot = NULL;
+			t->wheel = NULL;
+			w->count--;
+			fired++;
+			t->func(t);
+		}
+	}
+
+	return fired;
+}
+
+PE_EXPORT int pe_timer_wheel_next(const pe_timer_wheel_t * w,
+				  uint64_t * tick)
+{
+	uint64_t t;
+
+	if (w->count == 0)
+		return -1;
+
+	for (t = w->now + 1; t <= w->now + PE_TIMER_SLOTS; t++) {
+		if (!pe_dlist_empty(&(w->slots[0][SLOT(t, 0)])))
+			break;
+		/* higher levels cascade when level 0 wraps around */
+		if (SLOT(t, 0) == 0)
+			break;
+	}
+
+	*tick = t;
+	return 0;
+}
+
+PE_EXPORT void pe_timer_init(pe_timer_t * t, pe_timer_func_t func, void *data)
+{
+	t->link.next = t->link.prev = NULL;
+	t->slot = NULL;
+	t->wheel = NULL;
+	t->expires = 0;
+	t->func = func;
+	t->data = data;
+}
+
+PE_EXPORT void pe_timer_schedule(pe_timer_wheel_t * w, pe_timer_t * t,
+				 uint64_t expires)
+{
+	pe_timer_cancel(t);
+
+	if (expires <= w->now)
+		expires = w->now + 1;
+
+	t->expires = expires;
+	t->wheel = w;
+	w->count++;
+	place(w, t);
+}
+
+PE_EXPORT bool pe_timer_cancel(pe_timer_t * t)
+{
+	if (t->wheel == NULL)
+		return false;
+
+	pe_dlist_remove(t->slot, &(t->link));
+	t->slot = NULL;
+	t->wheel->count--;
+	t->wheel = NULL;
+	return true;
+}
@@ -80,6 +80,15 @@ PE_EXPORT void *pe_dll_sym(void *handle, const char *symbol)
 	return ref;
 }
 
+PE_EXPORT void pe_dll_close(void *handle)
+{
+#ifdef _WIN32
+	FreeLibrary((HINSTANCE) handle);
+#else
+	dlclose(handle);
+#endif
+}
+
 // DLL/SO end
 
 PE_EXPORT void pe_sleep(int ms)
@@ -96,12 +105,53 @@ PE_EXPORT void pe_sleep(int ms)
 #endif
 }
 
+/* offset of the real clocks at the time the virtual clock was enabled */
+static bool clock_virtual = false;
+static uint64_t clock_virtual_mono = 0;
+static uint64_t clock_virtual_wall = 0;
+static uint64_t clock_virtual_start = 0;
+
+static uint64_t tstamp_real_usec();
+
+PE_EXPORT void pe_clock_set_virtual(bool enable)
+{
+	if (enable == clock_virtual)
+		return;
+
+	if (enable) {
+		clock_virtual_start = pe_tstamp_mono_real_usec();
+		clock_virtual_wall = tstamp_real_usec();
+		__atomic_store_n(&clock_virtual_mono, clock_virtual_start,
+				 __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&clock_virtual, enable, __ATOMIC_RELEASE);
+}
+
+PE_EXPORT bool pe_clock_is_virtual()
+{
+	return __atomic_load_n(&clock_virtual, __ATOMIC_ACQUIRE);
+}
+
+PE_EXPORT void pe_clock_advance(uint64_t usec)
+{
+	__atomic_add_fetch(&clock_virtual_mono, usec, __ATOMIC_RELEASE);
+}
+
 PE_EXPORT uint64_t pe_tstamp_msec()
 {
 	return pe_tstamp_usec() / 1000;
 }
 
 PE_EXPORT uint64_t pe_tstamp_usec()
+{
+	if (pe_clock_is_virtual())
+		return clock_virtual_wall + pe_tstamp_mono_usec() -
+		    clock_virtual_start;
+
+	return tstamp_real_usec();
+}
+
+static uint64_t tstamp_real_usec()
 {
 	uint64_t res = 0.0;
 	uint64_t sec = 0ULL;
@@ -119,6 +169,55 @@ PE_EXPORT uint64_t pe_tstamp_usec()
 	return res;
 }
 
+PE_EXPORT uint64_t pe_tstamp_mono_usec()
+{
+	if (pe_clock_is_virtual())
+		return __atomic_load_n(&clock_virtual_mono, __ATOMIC_ACQUIRE);
+
+	return pe_tstamp_mono_real_usec();
+}
+
+PE_EXPORT uint64_t pe_tstamp_mono_real_usec()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER freq = { 0 };
+	LARGE_INTEGER now;
+
+	if (freq.QuadPart == 0)
+		QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&now);
+
+	return (uint64_t) (now.QuadPart / freq.QuadPart) * 1000000ULL +
+	    (uint64_t) (now.QuadPart % freq.QuadPart) * 1000000ULL /
+	    freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+#endif
+}
+
+PE_EXPORT void pe_sleep_until(uint64_t deadline)
+{
+	if (pe_clock_is_virtual()) {
+		uint64_t now = pe_tstamp_mono_usec();
+		if (deadline > now)
+			pe_clock_advance(deadline - now);
+		return;
+	}
+#ifdef _WIN32
+	uint64_t now = pe_tstamp_mono_usec();
+	if (deadline > now)
+		pe_sleep((deadline - now) / 1000);
+#else
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000000ULL;
+	ts.tv_nsec = (deadline % 1000000ULL) * 1000;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR) ;
+#endif
+}
+
 PE_EXPORT pe_perfmon_t *pe_perfmon_start(char *name)
 {
 	pe_perfmon_t *ret = malloc(sizeof(pe_perfmon_t));
@@ -149,13 +248,36 @@ PE_EXPORT pe_llist_t *pe_llist()
 		PE_ABORT(-1, "could not create list, malloc failed.");
 	}
 
-	l->next = NULL;
-	l->prev = NULL;
-	l->value = NULL;
-
+	pe_dlist_init(&(l->nodes));
 	return l;
 }
 
+PE_EXPORT void pe_llist_free(pe_llist_t * l)
+{
+	pe_dlink_t *n;
+
+	if (l == NULL)
+		return;
+
+	while ((n = pe_dlist_shift(&(l->nodes))) != NULL)
+		free(pe_container_of(n, pe_llist_node_t, link));
+	free(l);
+}
+
+static void *llist_take(pe_dlink_t * n)
+{
+	pe_llist_node_t *node;
+	void *retval;
+
+	if (n == NULL)
+		return NULL;
+
+	node = pe_container_of(n, pe_llist_node_t, link);
+	retval = node->value;
+	free(node);
+	return retval;
+}
+
 PE_EXPORT void *pe_llist_pop(pe_llist_t * l)
 {
 	if (l == NULL) {
@@ -163,72 +285,261 @@ PE_EXPORT void *pe_llist_pop(pe_llist_t * l)
 		return NULL;
 	}
 
-	void *retval = NULL;
-	pe_llist_t *current = NULL;
+	return llist_take(pe_dlist_pop(&(l->nodes)));
+}
 
-	if (l->next == NULL) {
-		retval = l->value;
-		free(l);
-		l = NULL;
-		return retval;
+PE_EXPORT void *pe_llist_shift(pe_llist_t * l)
+{
+	if (l == NULL) {
+		PE_ERROR(-1, "list must not be NULL");
+		return NULL;
 	}
 
-	current = l;
-	while (current->next->next != NULL)
-		current = current->next;
+	return llist_take(pe_dlist_shift(&(l->nodes)));
+}
 
-	retval = current->next->value;
-	free(current->next);
-	current->next = NULL;
+static pe_llist_node_t *llist_node(void *val)
+{
+	pe_llist_node_t *node = malloc(sizeof(pe_llist_node_t));
 
-	return retval;
+	if (node == NULL) {
+		PE_ABORT(-1, "could not create list node, malloc failed.");
+	}
+
+	node->value = val;
+	return node;
 }
 
-PE_EXPORT void *pe_llist_shift(pe_llist_t ** l)
+PE_EXPORT int pe_llist_push(pe_llist_t * l, void *val)
 {
-	void *retval = NULL;
-	pe_llist_t *next_node = NULL;
+	pe_dlist_push(&(l->nodes), &(llist_node(val)->link));
+	return 0;
+}
 
-	if (*l == NULL)
-		return NULL;
+PE_EXPORT int pe_llist_append(pe_llist_t * l, void *val)
+{
+	pe_dlist_append(&(l->nodes), &(llist_node(val)->link));
+	return 0;
+}
 
-	next_node = (*l)->next;
-	retval = (*l)->value;
-	free(*l);
-	*l = next_node;
-	return retval;
+PE_EXPORT size_t pe_llist_count(pe_llist_t * l)
+{
+	return l->nodes.count;
+}
+
+#define MAP_MIN_SLOTS 8
+
+static uint64_t map_hash_str(const char *key, bool nocase)
+{
+	/* FNV-1a */
+	uint64_t h = 14695981039346656037ULL;
+	unsigned char c;
+
+	while ((c = *key++) != '\0') {
+		if (nocase && c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		h = (h ^ c) * 1099511628211ULL;
+	}
+	return h != 0 ? h : 1;
 }
 
-PE_EXPORT int pe_llist_push(pe_llist_t ** l, void *val)
+static uint64_t map_hash_int(uint64_t key)
 {
-	pe_llist_t *new_node = pe_llist();
-	new_node->value = val;
-	new_node->next = *l;
-	*l = new_node;
+	/* splitmix64 finalizer */
+	key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+	key ^= key >> 31;
+	return key != 0 ? key : 1;
+}
+
+static bool map_match(const pe_map_t * m, const pe_map_entry_t * e,
+		      uint64_t hash, const char *s, uint64_t i)
+{
+	if (e->hash != hash)
+		return false;
+
+	switch (m->type) {
+	case MAP_STR:
+		return strcmp(e->key.s, s) == 0;
+	case MAP_STR_NOCASE:
+		return strcasecmp(e->key.s, s) == 0;
+	default:
+		return e->key.i == i;
+	}
+}
+
+/* slot holding the key, or the free slot it would go to */
+static size_t map_find(const pe_map_t * m, uint64_t hash, const char *s,
+		       uint64_t i)
+{
+	size_t idx = hash & m->mask;
+
+	while (m->entries[idx].hash != 0
+	       && !map_match(m, &(m->entries[idx]), hash, s, i))
+		idx = (idx + 1) & m->mask;
+
+	return idx;
+}
+
+static int map_resize(pe_map_t * m, size_t slots)
+{
+	pe_map_entry_t *old = m->entries;
+	size_t old_slots = old != NULL ? m->mask + 1 : 0;
+	size_t idx, j;
+
+	m->entries = calloc(slots, sizeof(pe_map_entry_t));
+	if (m->entries == NULL) {
+		m->entries = old;
+		return -1;
+	}
+	m->mask = slots - 1;
+
+	for (j = 0; j < old_slots; j++) {
+		if (old[j].hash == 0)
+			continue;
+		idx = old[j].hash & m->mask;
+		while (m->entries[idx].hash != 0)
+			idx = (idx + 1) & m->mask;
+		m->entries[idx] = old[j];
+	}
+
+	free(old);
 	return 0;
 }
 
-PE_EXPORT int pe_llist_append(pe_llist_t * l, void *val)
+PE_EXPORT int pe_map_init(pe_map_t * m, pe_map_key_t type, size_t capacity)
 {
-	pe_llist_t *current = l;
-	while (current->next != NULL)
-		current = current->next;
+	size_t slots = MAP_MIN_SLOTS;
+
+	while (slots / 4 * 3 < capacity)
+		slots *= 2;
+
+	m->entries = NULL;
+	m->mask = 0;
+	m->count = 0;
+	m->type = type;
+	return map_resize(m, slots);
+}
+
+PE_EXPORT void pe_map_free(pe_map_t * m)
+{
+	size_t i;
+
+	if (m->type != MAP_INT) {
+		pe_map_each(m, e, i) {
+			free(e->key.s);
+		}
+		pe_end;
+	}
 
-	pe_llist_t *new_list = pe_llist();
-	new_list->value = val;
-	current->next = new_list;
+	free(m->entries);
+	m->entries = NULL;
+	m->mask = 0;
+	m->count = 0;
+}
+
+static int map_put(pe_map_t * m, uint64_t hash, const char *s, uint64_t i,
+		   void *value)
+{
+	pe_map_entry_t *e;
+	size_t slots = m->entries != NULL ? m->mask + 1 : 0;
+
+	if ((m->count + 1) > slots / 4 * 3
+	    && map_resize(m, slots != 0 ? slots * 2 : MAP_MIN_SLOTS))
+		return -1;
+
+	e = &(m->entries[map_find(m, hash, s, i)]);
+	if (e->hash == 0) {
+		if (m->type != MAP_INT) {
+			e->key.s = strdup(s);
+			if (e->key.s == NULL)
+				return -1;
+		} else {
+			e->key.i = i;
+		}
+		e->hash = hash;
+		m->count++;
+	}
+	e->value = value;
 	return 0;
 }
 
-PE_EXPORT int pe_llist_count(pe_llist_t * l)
+static void *map_get(const pe_map_t * m, uint64_t hash, const char *s,
+		     uint64_t i)
+{
+	if (m->entries == NULL)
+		return NULL;
+
+	return m->entries[map_find(m, hash, s, i)].value;
+}
+
+static void *map_remove(pe_map_t * m, uint64_t hash, const char *s,
+			uint64_t i)
 {
-	int counter = 0;
-	pe_llist_t *current = l;
-	while (current->next != NULL) {
-		current = current->next;
-		counter++;
+	size_t idx, next, home;
+	void *value;
+
+	if (m->entries == NULL)
+		return NULL;
+
+	idx = map_find(m, hash, s, i);
+	if (m->entries[idx].hash == 0)
+		return NULL;
+
+	value = m->entries[idx].value;
+	if (m->type != MAP_INT)
+		free(m->entries[idx].key.s);
+	m->count--;
+
+	/* shift back followers that may not probe past the hole */
+	next = idx;
+	for (;;) {
+		next = (next + 1) & m->mask;
+		if (m->entries[next].hash == 0)
+			break;
+		home = m->entries[next].hash & m->mask;
+		if (((next - home) & m->mask) >= ((next - idx) & m->mask)) {
+			m->entries[idx] = m->entries[next];
+			idx = next;
+		}
 	}
-	return counter;
+
+	m->entries[idx].hash = 0;
+	m->entries[idx].value = NULL;
+	return value;
+}
+
+PE_EXPORT int pe_map_put(pe_map_t * m, const char *key, void *value)
+{
+	return map_put(m, map_hash_str(key, m->type == MAP_STR_NOCASE), key,
+		       0, value);
+}
+
+PE_EXPORT void *pe_map_get(const pe_map_t * m, const char *key)
+{
+	return map_get(m, map_hash_str(key, m->type == MAP_STR_NOCASE), key,
+		       0);
+}
+
+PE_EXPORT void *pe_map_remove(pe_map_t * m, const char *key)
+{
+	return map_remove(m, map_hash_str(key, m->type == MAP_STR_NOCASE),
+			  key, 0);
+}
+
+PE_EXPORT int pe_map_put_int(pe_map_t * m, uint64_t key, void *value)
+{
+	return map_put(m, map_hash_int(key), NULL, key, value);
+}
+
+PE_EXPORT void *pe_map_get_int(const pe_map_t * m, uint64_t key)
+{
+	return map_get(m, map_hash_int(key), NULL, key);
+}
+
+PE_EXPORT void *pe_map_remove_int(pe_map_t * m, uint64_t key)
+{
+	return map_remove(m, map_hash_int(key), NULL, key);
 }
 
 PE_EXPORT size_t pe_find_file(const char *path[], size_t plen,